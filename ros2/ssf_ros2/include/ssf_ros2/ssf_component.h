@@ -0,0 +1,169 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef SSF_COMPONENT_H_
+#define SSF_COMPONENT_H_
+
+#include <rclcpp/rclcpp.hpp>
+#include <sensor_msgs/msg/imu.hpp>
+#include <geometry_msgs/msg/pose_with_covariance_stamped.hpp>
+#include <ssf_ros2/msg/filter_state.hpp>
+
+#include <ssf_core/estimator.h>
+
+#include <string>
+#include <vector>
+
+namespace ssf_ros2
+{
+
+/// ROS 2 component running ssf_core::Estimator with IMU propagation and pose measurements
+/**
+ * The parameters mirror ssf_core/cfg/SSF_Core.cfg and may be changed at runtime. All callbacks run in the
+ * node's default, mutually exclusive callback group, so the single threaded Estimator needs no locking.
+ *
+ * Loaded into a container with use_intra_process_comms, the IMU and pose messages of drivers in the same
+ * process arrive without copies. The outputs are loaned from the middleware if it supports that for the
+ * message type, and are otherwise published as unique pointers, which intra-process subscribers take over
+ * without copies.
+ *
+ * The pose measures the scaled position and the attitude of the IMU in the world frame, with the noise
+ * from the message covariance, or from meas_noise1 (position) and meas_noise2 (attitude) where it is zero.
+ * The filter gets initialized from the first pose after IMU readings arrived, and again whenever
+ * init_filter gets set.
+ */
+class SsfComponent : public rclcpp::Node
+{
+public:
+	explicit SsfComponent(const rclcpp::NodeOptions & options);
+
+private:
+	typedef sensor_msgs::msg::Imu ImuMsg;
+	typedef geometry_msgs::msg::PoseWithCovarianceStamped PoseMsg;
+	typedef ssf_ros2::msg::FilterState FilterStateMsg;
+
+	/// the parameters of SSF_Core.cfg
+	struct Config
+	{
+		bool init_filter;
+		double scale_init;
+		bool fixed_scale, fixed_bias, fixed_calib;
+		double noise_acc, noise_accbias, noise_gyr, noise_gyrbias, noise_scale, noise_qwv, noise_qci, noise_pic;
+		double delay;
+		bool set_height;
+		double height;
+		double meas_noise1, meas_noise2;
+		bool gate_enable;
+		double gate_probability;
+		bool lazy_repropagation; ///< accepted for parameter file compatibility, the Estimator always replays right away
+		double repropagation_budget; ///< dito
+	};
+
+	struct BoolParam
+	{
+		const char * name;
+		bool Config::* member;
+		bool value;
+		const char * description;
+	};
+
+	struct DoubleParam
+	{
+		const char * name;
+		double Config::* member;
+		double value, min, max;
+		const char * description;
+	};
+
+	static const BoolParam boolParams_[];
+	static const DoubleParam doubleParams_[];
+
+	Config config_;
+	std::string frame_id_;
+	bool full_covariance_; ///< publish the full covariance in filter_state
+
+	ssf_core::Estimator estimator_;
+	bool init_requested_;
+	double delay_measurement_; ///< state time - measurement time of the last correction
+
+	// latest IMU readings, for the initialization
+	bool imu_received_;
+	double imu_time_;
+	Eigen::Matrix<double, 3, 1> a_m_, w_m_;
+
+	rclcpp::Subscription<ImuMsg>::SharedPtr subImu_;
+	rclcpp::Subscription<PoseMsg>::SharedPtr subPose_;
+	rclcpp::Publisher<PoseMsg>::SharedPtr pubPose_, pubPoseCorrected_;
+	rclcpp::Publisher<FilterStateMsg>::SharedPtr pubFilterState_;
+	OnSetParametersCallbackHandle::SharedPtr parametersHandle_;
+
+	/// declares the parameters of boolParams_ and doubleParams_ and reads their initial values
+	void declareParameters();
+
+	/// takes over changed parameters, the ranges got checked by rclcpp already
+	rcl_interfaces::msg::SetParametersResult parametersCallback(const std::vector<rclcpp::Parameter> & parameters);
+
+	/// passes the noise and fixed states of config_ to the estimator
+	void applyConfig();
+
+	void imuCallback(const ImuMsg::ConstSharedPtr msg);
+
+	void poseCallback(const PoseMsg::ConstSharedPtr msg);
+
+	/// starts the filter at the measured pose, with the latest IMU readings
+	void initialize(const Eigen::Matrix<double, 3, 1> & z_p, const Eigen::Quaternion<double> & z_q);
+
+	void publishPose(rclcpp::Publisher<PoseMsg> & pub, const ssf_core::State & state);
+
+	void publishFilterState(const ssf_core::State & state);
+
+	/// fills a message with fill and publishes it, loaned from the middleware if it supports that
+	template<class MsgT, class Fill>
+		static void publishLoaned(rclcpp::Publisher<MsgT> & pub, Fill fill)
+		{
+			if (pub.can_loan_messages())
+			{
+				auto msg = pub.borrow_loaned_message();
+				fill(msg.get());
+				pub.publish(std::move(msg));
+			}
+			else
+			{
+				std::unique_ptr<MsgT> msg(new MsgT());
+				fill(*msg);
+				pub.publish(std::move(msg));
+			}
+		}
+};
+
+}; // end namespace
+
+#endif /* SSF_COMPONENT_H_ */
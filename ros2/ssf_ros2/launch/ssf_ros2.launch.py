@@ -0,0 +1,30 @@
+import os
+
+from ament_index_python.packages import get_package_share_directory
+from launch import LaunchDescription
+from launch_ros.actions import ComposableNodeContainer
+from launch_ros.descriptions import ComposableNode
+
+
+def generate_launch_description():
+    params = os.path.join(get_package_share_directory('ssf_ros2'), 'pose_sensor_fix.yaml')
+
+    # load the IMU driver and the pose source into the same container to skip serialization of their messages
+    return LaunchDescription([
+        ComposableNodeContainer(
+            name='ekf_container',
+            namespace='',
+            package='rclcpp_components',
+            executable='component_container',
+            composable_node_descriptions=[
+                ComposableNode(
+                    package='ssf_ros2',
+                    plugin='ssf_ros2::SsfComponent',
+                    name='ekf_fusion',
+                    parameters=[params],
+                    remappings=[('~/imu_state_input', '/imu0'),
+                                ('~/pose_measurement', '/vicon/pose')],
+                    extra_arguments=[{'use_intra_process_comms': True}]),
+            ],
+            output='screen'),
+    ])
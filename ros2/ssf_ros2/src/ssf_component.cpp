@@ -0,0 +1,335 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <ssf_ros2/ssf_component.h>
+#include <ssf_core/eigen_utils.h>
+
+#include <rclcpp_components/register_node_macro.hpp>
+
+#include <cstring>
+#include <functional>
+
+namespace ssf_ros2
+{
+
+// name, member, default, description as in SSF_Core.cfg
+const SsfComponent::BoolParam SsfComponent::boolParams_[] = {
+	{"init_filter", &Config::init_filter, false, "call filter init using defined scale"},
+	{"fixed_scale", &Config::fixed_scale, false, "fix scale"},
+	{"fixed_bias", &Config::fixed_bias, false, "fix biases"},
+	{"fixed_calib", &Config::fixed_calib, false, "fix calibration states"},
+	{"set_height", &Config::set_height, false, "call filter init using defined height"},
+	{"gate_enable", &Config::gate_enable, true, "reject measurements failing the chi-square innovation test"},
+	{"lazy_repropagation", &Config::lazy_repropagation, false, "replay states after a delayed correction only when they are needed"},
+};
+
+// name, member, default, min, max, description as in SSF_Core.cfg
+const SsfComponent::DoubleParam SsfComponent::doubleParams_[] = {
+	{"scale_init", &Config::scale_init, 1, 0.001, 30, "value for initial scale"},
+	{"noise_acc", &Config::noise_acc, 0.0083, 1.0e-4, 0.5, "noise accelerations (std. dev)"},
+	{"noise_accbias", &Config::noise_accbias, 0.00083, 1.0e-7, 0.1, "noise acceleration bias  (std. dev)"},
+	{"noise_gyr", &Config::noise_gyr, 0.0013, 1.0e-4, 0.5, "noise gyros (std. dev)"},
+	{"noise_gyrbias", &Config::noise_gyrbias, 0.00013, 1.0e-7, 0.1, "noise gyro biases  (std. dev)"},
+	{"noise_scale", &Config::noise_scale, 0.0, 0, 10.0, "noise scale (std. dev)"},
+	{"noise_qwv", &Config::noise_qwv, 0.0, 0, 10.0, "noise qwv (std. dev)"},
+	{"noise_qci", &Config::noise_qci, 0.0, 0, 10.0, "noise qci (std. dev)"},
+	{"noise_pic", &Config::noise_pic, 0.0, 0, 10.0, "noise pic (std. dev)"},
+	{"delay", &Config::delay, 0.03, -2.0, 2.0, "fix delay in seconds"},
+	{"height", &Config::height, 1, 0.1, 20, "height in m for init"},
+	{"meas_noise1", &Config::meas_noise1, 0.01, 0, 10, "noise for measurement sensor (std. dev)"},
+	{"meas_noise2", &Config::meas_noise2, 0.01, 0, 100000, "noise for measurement sensor (std. dev)"},
+	{"gate_probability", &Config::gate_probability, 0.999, 0.9, 0.999999, "confidence level of the chi-square innovation gate"},
+	{"repropagation_budget", &Config::repropagation_budget, 0.0005, 0, 0.01, "time budget in seconds for lazy replay per IMU sample, 0 for no limit"},
+};
+
+/// seconds to a message stamp
+static builtin_interfaces::msg::Time toStamp(double time)
+{
+	const int64_t nsec = static_cast<int64_t>(time * 1e9);
+	builtin_interfaces::msg::Time stamp;
+	stamp.sec = static_cast<int32_t>(nsec / 1000000000);
+	stamp.nanosec = static_cast<uint32_t>(nsec % 1000000000);
+	return stamp;
+}
+
+SsfComponent::SsfComponent(const rclcpp::NodeOptions & options) :
+	rclcpp::Node("ssf_core", options), init_requested_(false), delay_measurement_(0), imu_received_(false), imu_time_(0)
+{
+	a_m_.setZero();
+	w_m_.setZero();
+
+	declareParameters();
+	frame_id_ = declare_parameter("frame_id", std::string("world_frame"));
+	full_covariance_ = declare_parameter("filter_state_covariance", false);
+	applyConfig();
+
+	parametersHandle_ = add_on_set_parameters_callback(std::bind(&SsfComponent::parametersCallback, this, std::placeholders::_1));
+
+	// keep-last and volatile, as intra-process communication requires
+	pubPose_ = create_publisher<PoseMsg>("~/pose", 3);
+	pubPoseCorrected_ = create_publisher<PoseMsg>("~/pose_corrected", 3);
+	pubFilterState_ = create_publisher<FilterStateMsg>("~/filter_state", 3);
+
+	estimator_.setPropagatedCallback([this](const ssf_core::State & state) {publishPose(*pubPose_, state);});
+	estimator_.setCorrectedCallback([this](const ssf_core::State & state) {publishPose(*pubPoseCorrected_, state);});
+	estimator_.setWarningCallback([this](const char * warning) {RCLCPP_WARN(get_logger(), "%s", warning);});
+
+	subImu_ = create_subscription<ImuMsg>("~/imu_state_input", rclcpp::SensorDataQoS(),
+			std::bind(&SsfComponent::imuCallback, this, std::placeholders::_1));
+	subPose_ = create_subscription<PoseMsg>("~/pose_measurement", 10,
+			std::bind(&SsfComponent::poseCallback, this, std::placeholders::_1));
+
+	RCLCPP_INFO(get_logger(), "waiting for IMU readings and a pose to initialize the filter, intra-process comms %s",
+			options.use_intra_process_comms() ? "on" : "off");
+}
+
+void SsfComponent::declareParameters()
+{
+	for (const BoolParam & param : boolParams_)
+	{
+		rcl_interfaces::msg::ParameterDescriptor descriptor;
+		descriptor.description = param.description;
+		config_.*param.member = declare_parameter(param.name, param.value, descriptor);
+	}
+
+	for (const DoubleParam & param : doubleParams_)
+	{
+		rcl_interfaces::msg::ParameterDescriptor descriptor;
+		descriptor.description = param.description;
+		rcl_interfaces::msg::FloatingPointRange range;
+		range.from_value = param.min;
+		range.to_value = param.max;
+		descriptor.floating_point_range.push_back(range);
+		config_.*param.member = declare_parameter(param.name, param.value, descriptor);
+	}
+
+	init_requested_ = config_.init_filter;
+}
+
+rcl_interfaces::msg::SetParametersResult SsfComponent::parametersCallback(const std::vector<rclcpp::Parameter> & parameters)
+{
+	for (const rclcpp::Parameter & parameter : parameters)
+	{
+		for (const BoolParam & param : boolParams_)
+			if (parameter.get_name() == param.name)
+				config_.*param.member = parameter.as_bool();
+
+		for (const DoubleParam & param : doubleParams_)
+			if (parameter.get_name() == param.name)
+				config_.*param.member = parameter.as_double();
+
+		if (parameter.get_name() == "frame_id")
+			frame_id_ = parameter.as_string();
+		else if (parameter.get_name() == "filter_state_covariance")
+			full_covariance_ = parameter.as_bool();
+		else if (parameter.get_name() == "init_filter" || parameter.get_name() == "set_height")
+			init_requested_ = init_requested_ || parameter.as_bool(); // every set to true requests a new initialization
+	}
+
+	applyConfig();
+
+	rcl_interfaces::msg::SetParametersResult result;
+	result.successful = true;
+	return result;
+}
+
+void SsfComponent::applyConfig()
+{
+	ssf_core::ProcessNoise noise;
+	noise.setConstant(config_.noise_acc, config_.noise_accbias, config_.noise_gyr, config_.noise_gyrbias, config_.noise_scale,
+			config_.noise_qwv, config_.noise_qci, config_.noise_pic);
+	estimator_.setProcessNoise(noise);
+	estimator_.setCorrectionMask(ssf_core::correctionMask(config_.fixed_scale, config_.fixed_bias, config_.fixed_calib));
+}
+
+void SsfComponent::imuCallback(const ImuMsg::ConstSharedPtr msg)
+{
+	imu_time_ = rclcpp::Time(msg->header.stamp).seconds();
+	a_m_ << msg->linear_acceleration.x, msg->linear_acceleration.y, msg->linear_acceleration.z;
+	w_m_ << msg->angular_velocity.x, msg->angular_velocity.y, msg->angular_velocity.z;
+	imu_received_ = true;
+
+	if (!estimator_.initialized())
+		return;
+
+	if (!estimator_.addImu(imu_time_, a_m_, w_m_))
+		RCLCPP_WARN_THROTTLE(get_logger(), *get_clock(), 1000, "IMU reading out of order, dropped");
+}
+
+void SsfComponent::poseCallback(const PoseMsg::ConstSharedPtr msg)
+{
+	typedef Eigen::Matrix<double, 6, 6, Eigen::RowMajor> Matrix6;
+
+	const Eigen::Matrix<double, 3, 1> z_p(msg->pose.pose.position.x, msg->pose.pose.position.y, msg->pose.pose.position.z);
+	const Eigen::Quaternion<double> z_q(msg->pose.pose.orientation.w, msg->pose.pose.orientation.x,
+			msg->pose.pose.orientation.y, msg->pose.pose.orientation.z);
+
+	if (!imu_received_)
+		return;
+
+	if (!estimator_.initialized() || init_requested_)
+	{
+		initialize(z_p, z_q.normalized());
+		return;
+	}
+
+	const double time = rclcpp::Time(msg->header.stamp).seconds() - config_.delay;
+	const ssf_core::State * state = estimator_.closestState(time);
+	if (!state)
+	{
+		RCLCPP_WARN_THROTTLE(get_logger(), *get_clock(), 1000, "measurement older than the state buffer, rejected");
+		return;
+	}
+
+	// noise from the message, with the parameters where it has none
+	const Eigen::Map<const Matrix6> cov(msg->pose.covariance.data());
+	Matrix6 R = cov;
+	if (R.block<3, 3>(0, 0).isZero())
+		R.block<3, 3>(0, 0).diagonal().setConstant(config_.meas_noise1 * config_.meas_noise1);
+	if (R.block<3, 3>(3, 3).isZero())
+		R.block<3, 3>(3, 3).diagonal().setConstant(config_.meas_noise2 * config_.meas_noise2);
+
+	// scaled position and attitude of the IMU in the world frame
+	Eigen::Matrix<double, 6, N_STATE> H;
+	H.setZero();
+	H.block<3, 3>(0, 0) = Eigen::Matrix<double, 3, 3>::Identity() * state->L_; // p
+	H.block<3, 1>(0, 15) = state->p_; // L
+	H.block<3, 3>(3, 6) = Eigen::Matrix<double, 3, 3>::Identity(); // q
+
+	Eigen::Matrix<double, 6, 1> r;
+	r.block<3, 1>(0, 0) = z_p - state->p_ * state->L_;
+	Eigen::Quaternion<double> q_err = state->q_.conjugate() * z_q;
+	q_err.normalize();
+	r.block<3, 1>(3, 0) = q_err.vec() / q_err.w() * 2;
+
+	const double gate_probability = config_.gate_probability;
+	const bool gate_enable = config_.gate_enable;
+	const ssf_core::UpdateStatus status = estimator_.applyMeasurement(H, r, R,
+			[gate_enable, gate_probability](double distance, int dof)
+			{
+				return !gate_enable || distance <= chiSquareQuantile(dof, gate_probability);
+			});
+
+	if (status == ssf_core::UPDATE_SINGULAR)
+		RCLCPP_WARN(get_logger(), "innovation covariance not positive definite, rejecting measurement");
+	else if (status == ssf_core::UPDATE_GATED)
+		RCLCPP_WARN_THROTTLE(get_logger(), *get_clock(), 1000, "measurement rejected by the innovation gate");
+	else
+	{
+		delay_measurement_ = estimator_.head().time_ - time;
+		publishFilterState(estimator_.head());
+	}
+}
+
+void SsfComponent::initialize(const Eigen::Matrix<double, 3, 1> & z_p, const Eigen::Quaternion<double> & z_q)
+{
+	ssf_core::State state;
+	state.time_ = imu_time_;
+	state.a_m_ = a_m_;
+	state.w_m_ = w_m_;
+
+	state.L_ = config_.scale_init;
+	if (config_.set_height && z_p[2] != 0)
+		state.L_ = z_p[2] / config_.height;
+
+	state.p_ = z_p / state.L_;
+	state.q_ = z_q;
+	state.v_.setZero();
+	state.q_int_ = state.q_;
+	state.p_int_ = state.p_;
+	state.v_int_.setZero();
+
+	// initial error state std. devs: p v q b_w b_a L q_wv q_ci p_ci
+	const double init_n[] = {0, 0.1, 0.001, 0.0005, 0.015, 0.0001, 0, 0.0001, 0.0001};
+	const int init_size[] = {3, 3, 3, 3, 3, 1, 3, 3, 3};
+	ssf_core::ErrorState P_diagonal;
+	for (int i = 0, row = 0; i < 9; row += init_size[i], i++)
+		P_diagonal.segment(row, init_size[i]).setConstant(init_n[i] * init_n[i]);
+	state.P_ = P_diagonal.asDiagonal();
+
+	estimator_.initialize(state, Eigen::Matrix<double, 3, 1>(0, 0, 9.81));
+	init_requested_ = false;
+
+	RCLCPP_INFO_STREAM(get_logger(), "filter initialized to position [" << state.p_.transpose() << "], scale " << state.L_);
+}
+
+void SsfComponent::publishPose(rclcpp::Publisher<PoseMsg> & pub, const ssf_core::State & state)
+{
+	if (pub.get_subscription_count() == 0)
+		return;
+
+	publishLoaned(pub, [this, &state](PoseMsg & msg)
+	{
+		msg.header.stamp = toStamp(state.time_);
+		msg.header.frame_id = frame_id_;
+		msg.pose.pose.position.x = state.p_[0];
+		msg.pose.pose.position.y = state.p_[1];
+		msg.pose.pose.position.z = state.p_[2];
+		msg.pose.pose.orientation.w = state.q_.w();
+		msg.pose.pose.orientation.x = state.q_.x();
+		msg.pose.pose.orientation.y = state.q_.y();
+		msg.pose.pose.orientation.z = state.q_.z();
+
+		// position and attitude blocks of the error state covariance
+		Eigen::Map<Eigen::Matrix<double, 6, 6, Eigen::RowMajor> > cov(msg.pose.covariance.data());
+		cov.block<3, 3>(0, 0) = state.P_.block<3, 3>(0, 0);
+		cov.block<3, 3>(0, 3) = state.P_.block<3, 3>(0, 6);
+		cov.block<3, 3>(3, 0) = state.P_.block<3, 3>(6, 0);
+		cov.block<3, 3>(3, 3) = state.P_.block<3, 3>(6, 6);
+	});
+}
+
+void SsfComponent::publishFilterState(const ssf_core::State & state)
+{
+	if (pubFilterState_->get_subscription_count() == 0)
+		return;
+
+	publishLoaned(*pubFilterState_, [this, &state](FilterStateMsg & msg)
+	{
+		double data[ssf_core::state_layout::value::nValues + N_STATE];
+		state.toStateArray(data);
+
+		msg.header.stamp = toStamp(state.time_);
+		msg.header.frame_id = frame_id_;
+		msg.delay_measurement = delay_measurement_;
+		std::memcpy(msg.state.data(), data, sizeof(msg.state));
+		std::memcpy(msg.covariance_diagonal.data(), data + ssf_core::state_layout::value::nValues, sizeof(msg.covariance_diagonal));
+		if (full_covariance_)
+		{
+			msg.covariance.resize(ssf_core::state_layout::nPackedCovariance);
+			state.toPackedCovariance(msg.covariance.data());
+		}
+	});
+}
+
+}; // end namespace
+
+RCLCPP_COMPONENTS_REGISTER_NODE(ssf_ros2::SsfComponent)
@@ -36,6 +36,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <Eigen/Eigen>
 
 #include <ros/ros.h>
+#include <ros/callback_queue.h>
 #include <dynamic_reconfigure/server.h>
 #include <ssf_core/SSF_CoreConfig.h>
 
@@ -55,7 +56,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <ssf_core/visensor_imu.h>
 
 #include <vector>
-#include <ssf_core/state.h>
+#include <ssf_core/state_conversions.h>
+#include <ssf_core/ekf.h>
 
 #include <tf2_ros/transform_broadcaster.h>
 #include <tf2_eigen/tf2_eigen.h>
@@ -65,6 +67,21 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <cmath>
 
 #include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <memory>
+
+#include <ssf_core/spsc_queue.h>
+#include <ssf_core/output_stage.h>
+#include <ssf_core/allocation_guard.h>
+#include <ssf_core/worker_pool.h>
+#include <ssf_core/parameters.h>
+#include <ssf_core/logger.h>
+#include <ssf_core/shm_state.h>
+
+#include <Eigen/StdVector>
 
 #define N_STATE_BUFFER 256	///< size of unsigned char, do not change!
 #define HLI_EKF_STATE_SIZE 16 	///< number of states exchanged with external propagation. Here: p,v,q,bw,bw=16
@@ -82,18 +99,86 @@ struct ImuInputsCache{
 	Eigen::Quaternion<double> q_m_;
 };
 
+/// IMU readings as handed from the ROS callbacks to the filter
+struct ImuSample{
+	ros::Time stamp;
+	uint32_t seq;
+	Eigen::Matrix<double,3,1> w_m_;         ///< angular velocity from IMU
+	Eigen::Matrix<double,3,1> a_m_;         ///< acceleration from IMU
+	Eigen::Matrix<double,3,1> m_m_;         ///< magnetometer readings
+	Eigen::Quaternion<double> q_m_;         ///< attitude measurement
+	std::chrono::steady_clock::time_point received; ///< when the reading reached the core, for deadline tracking
+
+	/// external propagation: p_, v_ and q_ come from the autopilot (ExtEkf current_state), see stateCallback()
+	bool external;
+	Eigen::Matrix<double,3,1> p_;
+	Eigen::Matrix<double,3,1> v_;
+	Eigen::Quaternion<double> q_;
+
+	ImuSample() : seq(0), external(false) {}
+};
+
+/// called by the filter to process a queued measurement, context is the registered handler object
+typedef void (*MeasurementCallback)(void * context, const boost::shared_ptr<const void> & msg);
+
+/// a measurement waiting to be processed by the filter thread
+/**
+ * Plain handler and context plus the message pointer, so queueing copies a few words and bumps the
+ * reference count without touching the heap. The filter thread drops its reference when the event
+ * gets popped: if the subscriber let go of the message already, it is freed there.
+ */
+struct MeasurementEvent{
+	ros::Time stamp;
+	MeasurementCallback handler;
+	void * context;
+	boost::shared_ptr<const void> msg;
+
+	MeasurementEvent() : handler(nullptr), context(nullptr) {}
+};
+
+/// accept/reject statistics of the chi-square innovation gate
+struct GateStatistics{
+	unsigned int accepted;
+	unsigned int rejected;
+	double last_distance;	///< squared Mahalanobis distance of the last tested innovation
+	double last_threshold;	///< gate threshold the last innovation was tested against
+};
+
 enum ClosestStateStatus{
 	TOO_OLD,
 	TOO_EARLY,
 	FOUND
 };
 
+/// what the core gives up under sustained overload, every level includes the ones before
+enum DegradationLevel{
+	NOMINAL,
+	SKIP_COVARIANCE,		///< the covariance gets propagated in strides over several IMU readings
+	DECIMATE_MEASUREMENTS,	///< low priority measurement sources get decimated
+	DEFER_REPLAY			///< corrections get replayed lazily within the budget, even without lazy_repropagation
+};
+
+/// result of SSF_Core::commitMeasurement()
+enum CommitStatus{
+	COMMITTED,
+	REJECTED,	///< rejected by the innovation gate or the update failed
+	STALE		///< the buffer got corrected since the snapshot was taken, prepare again
+};
+
+/// copy of the buffered state a measurement refers to, taken by SSF_Core::prepareMeasurement()
+struct MeasurementSnapshot{
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+	State state;			///< state closest to the measurement time
+	unsigned char idx;		///< its index in the ringbuffer
+	unsigned int version;	///< buffer version at the time the snapshot was taken
+};
+
 class SSF_Core
 {
 
 public:
-	typedef Eigen::Matrix<double, N_STATE, 1> ErrorState;
-	typedef Eigen::Matrix<double, N_STATE, N_STATE> ErrorStateCov;
+	typedef ssf_core::ErrorState ErrorState;
+	typedef ssf_core::ErrorStateCov ErrorStateCov;
 
 	/// big init routine
 	void initialize(const Eigen::Matrix<double, 3, 1> & p, const Eigen::Matrix<double, 3, 1> & v,
@@ -105,13 +190,32 @@ public:
 									const Eigen::Quaternion<double> & q_ci, const Eigen::Matrix<double, 3, 1> & p_ci);
 
 	/// retreive all state information at time t. Used to build H, residual and noise matrix by update sensors
+	/**
+	 * call with state_mutex_ held (e.g. mutexLock()). Only the nominal state gets brought up to date,
+	 * prepareMeasurement() also catches up the covariance.
+	 */
 	ClosestStateStatus getClosestState(State*& timestate, ros::Time tstamp, double delay, unsigned char &idx);
 
+	/// retreive the newest state, for sensors without delay (e.g. Vicon, UWB). Updates on it are applied in place without replay,
+	/// unless new IMU readings arrived in the meantime. Same locking as getClosestState()
+	ClosestStateStatus getHeadState(State*& timestate, unsigned char &idx);
+
+	/// two-phase measurement update, step 1: snapshot the state closest to tstamp
+	/**
+	 * holds cov_mutex_ for the buffer search, the covariance catch-up and the copy, the nominal state lock
+	 * only briefly, so the IMU path keeps going. H, residual and R can then be
+	 * built on snapshot.state without holding the lock and be applied with commitMeasurement()
+	 */
+	ClosestStateStatus prepareMeasurement(MeasurementSnapshot & snapshot, ros::Time tstamp, double delay);
+
 	/// get all state information at a given index in the ringbuffer
 	//bool getStateAtIdx(State* timestate, unsigned char idx);
 
-	bool isInitFilter(){return config_.init_filter;}
-	double getInitScale(){return config_.scale_init;}
+	bool isInitFilter(){return params_.get()->config.init_filter;}
+	double getInitScale(){return params_.get()->config.scale_init;}
+
+	/// current parameter snapshot, stays valid for the duration of a measurement update
+	const Parameters * getParameters(){return params_.get();}
 
 	int getNumberofState(){return idx_state_;};
 
@@ -119,6 +223,8 @@ public:
 
 	void setGlobalStart(const ros::Time global_start)
 	{
+		std::lock_guard<std::mutex> lock(state_mutex_);
+
 		if (lastImuInputsTime_.isZero())
 		{
 			std::cerr << "ERROR: global_start_ cannot be set before first IMU inputs coming in." << std::endl;
@@ -151,14 +257,159 @@ public:
 		return isImuCacheReady;
 	}
 
-	State getCurrentState(unsigned char& idx){idx = idx_state_; return StateBuffer_[idx_state_];}
+	State getCurrentState(unsigned char& idx){std::lock_guard<std::mutex> lock(state_mutex_); repropagate((unsigned char)(idx_state_ - 1), 0); idx = idx_state_; return StateBuffer_[idx_state_];}
+
+	/// counters are written by the updates under cov_mutex_, do not call with it held
+	GateStatistics getGateStatistics(){std::lock_guard<std::mutex> lock(cov_mutex_); return gate_stats_;}
+
+	DegradationLevel getDegradation(){return (DegradationLevel)degradation_.load();}
+
+	/// registers a measurement source, returns its id for postMeasurement()
+	/**
+	 * every source gets its own single-producer queue, so postMeasurement() must only be called
+	 * from one thread (i.e. one ROS subscription) per source. Register sources from the thread that
+	 * created the core. Under overload, sources with a lower priority get decimated first.
+	 */
+	int addMeasurementSource(int priority = 0);
+
+	/// hands a measurement to the filter
+	/**
+	 * With the filter thread, handler(context, msg) gets called from there in timestamp order with the
+	 * IMU readings, once the state has been propagated up to stamp. Otherwise it is called right away.
+	 * measurementCallback() builds handler from a member function taking the message ConstPtr.
+	 */
+	void postMeasurement(int source, const ros::Time & stamp, MeasurementCallback handler, void * context,
+			const boost::shared_ptr<const void> & msg);
+
+	/// MeasurementCallback calling (context->*Process)(msg) with msg cast back to Msg
+	template<class Handler, class Msg, void (Handler::*Process)(boost::shared_ptr<const Msg>)>
+		static void measurementCallback(void * context, const boost::shared_ptr<const void> & msg)
+		{
+			(static_cast<Handler*>(context)->*Process)(boost::static_pointer_cast<const Msg>(msg));
+		}
+
+	/// true if inputs get queued and processed in timestamp order by the filter thread or an external scheduler
+	bool usesInputQueues(){return filter_thread_.joinable() || external_scheduling_;}
+
+	/// external scheduling: serves the IMU callback queue and processes up to max_items pending inputs
+	/**
+	 * used by hosts running many filters on a shared thread pool instead of a filter thread each.
+	 * Must not be called concurrently for the same instance. Returns the number of inputs processed.
+	 */
+	int runOnce(int max_items);
+
+	/// external scheduling: called whenever new inputs got queued, e.g. to wake up the host's workers
+	void setInputNotification(const boost::function<void()> & notify){input_notify_ = notify;}
 
-	SSF_Core();
+	/// \param nh node handle for the topics and parameters of this instance
+	/// \param external_scheduling no filter and IMU spinner threads, the owner calls runOnce() instead
+	SSF_Core(const ros::NodeHandle & nh = ros::NodeHandle("~"), bool external_scheduling = false);
 	~SSF_Core();
 
 private:
 
-	std::mutex core_mutex;
+	/// the core is split into two lock domains, always taken in this order if both are needed:
+	/**
+	 * cov_mutex_ guards the covariances, idx_P_ and the update bookkeeping (correction_, qbuff_, gate
+	 * statistics) and serializes all corrections, i.e. everything rewriting past nominal states.
+	 * state_mutex_ guards the nominal head: idx_state_, the dirty range and the newest states.
+	 * The IMU path only holds state_mutex_ and just tries cov_mutex_, so a long covariance catch-up or
+	 * update never stalls it. Since the dirty range can only grow with cov_mutex_ held, the states
+	 * before it may be read without state_mutex_ by whoever holds cov_mutex_.
+	 */
+	std::mutex cov_mutex_;
+	std::mutex state_mutex_;
+	const static int nCovarianceCatchUp_ = 4; ///< covariance propagation steps per IMU reading at most
+	const static int nCovarianceStride_ = 4; ///< IMU readings per covariance step when degraded
+
+	/// filter thread, consumes IMU readings and measurements in timestamp order
+	const static int nMaxMeasurementSources_ = 8;
+	const static int nMeasurementQueue_ = 16;
+	typedef SpscQueue<ImuSample, N_STATE_BUFFER> ImuQueue;
+	typedef SpscQueue<MeasurementEvent, nMeasurementQueue_> MeasurementQueue;
+	ImuQueue imu_queue_;
+	std::unique_ptr<MeasurementQueue> measurement_queues_[nMaxMeasurementSources_];
+	std::atomic<int> n_measurement_sources_;
+	std::thread filter_thread_;
+	std::atomic<bool> filter_running_;
+	std::mutex filter_wait_mutex_; ///< only used to sleep on filter_cv_, never held while filtering
+	std::condition_variable filter_cv_;
+	bool input_pending_; ///< inputs got queued since the filter thread last woke up, guarded by filter_wait_mutex_
+
+	/// real-time mode: locked memory, optional SCHED_FIFO/affinity of the filter thread and no log formatting on the hot path
+	bool realtime_;
+	int filter_thread_priority_; ///< SCHED_FIFO priority of the filter thread, 0 keeps the default scheduler
+	int filter_thread_cpu_; ///< CPU the filter thread gets pinned to, -1 for no affinity
+	const static int nWarmup_ = 2 * N_STATE_BUFFER; ///< IMU readings processed before the allocation guard gets armed
+	int n_warmup_;
+
+	/// overload protection: every IMU reading has to be processed within a deadline after its reception.
+	/// If it misses them persistently, the core degrades level by level instead of building up a backlog
+	double imu_deadline_; ///< seconds, <= 0 for twice the IMU period
+	double imu_period_; ///< running average of the IMU period
+	ros::Time last_deadline_stamp_;
+	double deadline_miss_rate_; ///< running average of the missed deadlines
+	int degradation_samples_; ///< IMU readings since the last level change
+	std::atomic<int> degradation_; ///< DegradationLevel, also read on the measurement path
+	int max_degradation_; ///< NOMINAL disables the overload protection
+	ros::Time last_degradation_output_;
+	std::atomic<unsigned long> shed_measurements_;
+	int measurement_priority_[nMaxMeasurementSources_];
+	unsigned int measurement_count_[nMaxMeasurementSources_]; ///< per source, only touched by the thread processing it
+	const static int nDegradationHold_ = 100; ///< IMU readings a level is kept at least
+
+	ros::NodeHandle nh_; ///< private node handle of this instance
+	bool external_scheduling_;
+	boost::function<void()> input_notify_;
+
+	/// filter thread main loop
+	void filterLoop();
+
+	/// processes the oldest pending input, returns false if there is nothing to do yet
+	bool processPendingInput();
+
+	/// wakes up the filter thread after new inputs got queued
+	void notifyFilter();
+
+	/// overload protection: checks the deadline of a processed IMU reading and adapts the degradation level
+	void trackDeadline(const ImuSample & sample);
+
+	/// overload protection: true if the measurement of source should be dropped to decimate it
+	bool shedMeasurement(int source);
+
+	/// IMU subscriptions run on their own queue and spinner thread, independent of measurement load
+	ros::CallbackQueue imu_callback_queue_;
+	std::thread imu_spinner_thread_;
+	std::atomic<bool> imu_spinning_;
+
+	/// IMU spinner thread main loop, priority > 0 requests SCHED_FIFO
+	void spinImu(int priority);
+
+	// per instance bookkeeping of the IMU input checks and the transform broadcasts
+	int imu_cache_idx_; ///< number of IMU readings written to imuInputsCache
+	Eigen::Matrix<double, 3, 1> last_am_; ///< last accepted acceleration reading
+	Eigen::Matrix<double, 3, 1> last_wm_; ///< last accepted angular velocity reading
+	bool closest_state_started_; ///< getClosestState() has been called before
+	bool ci_pre_measurement_, iw_pre_measurement_; ///< no measurement transform has been broadcast yet
+	int ci_seq_, iw_seq_;
+	double tf_calib_position_threshold_, tf_calib_angle_threshold_; ///< calibration changes below are not re-sent
+	Eigen::Matrix<double, 3, 1> last_p_ci_; ///< calibration last sent
+	Eigen::Quaternion<double> last_q_ci_;
+	double tf_world_imu_period_; ///< seconds between two world-IMU transforms at least, 0 for every measurement
+	ros::Time last_iw_stamp_; ///< stamp of the world-IMU transform last sent
+	std::string tf_prefix_; ///< prepended to the frame ids, to tell the transforms of several instances apart
+
+	/// IMU input path, ~imu_input_mode:
+	/// "synchronized" pairs sensor_msgs/Imu and MagneticField with identical stamps,
+	/// "visensor" reads both from a single ssf_core/visensor_imu topic,
+	/// "imu_only" propagates on sensor_msgs/Imu alone and attaches the latest magnetometer reading, if any,
+	/// "external" takes the states propagated on the autopilot (ExtEkf on hl_state_input) and sends corrections back
+	std::string imu_input_mode_;
+	bool external_propagation_; ///< imu_input_mode_ is "external"
+
+	ros::Subscriber subImuDirect_; ///< visensor and imu_only mode
+	ros::Subscriber subMagDirect_; ///< imu_only mode, optional
+	Eigen::Matrix<double,3,1> last_mag_; ///< imu_only mode: latest magnetometer reading, zero before the first one
 
 	ros::WallTimer check_synced_timer_;
 	int imu_received_, mag_received_, all_received_;
@@ -190,12 +441,26 @@ private:
 	Eigen::Matrix<double, N_STATE, N_STATE> Fd_; ///< discrete state propagation matrix
 	Eigen::Matrix<double, N_STATE, N_STATE> Qd_; ///< discrete propagation noise matrix
 
+	/// parallel covariance catch-up, only set up with ~covariance_threads > 1
+	typedef std::vector<ErrorStateCov, Eigen::aligned_allocator<ErrorStateCov> > ErrorStateCovVector;
+	const static int nMinParallelCovariance_ = 32; ///< fewer states are propagated sequentially
+	const static int nMinCovarianceChunk_ = 8; ///< minimum number of states per thread
+	std::unique_ptr<WorkerPool> covariance_pool_;
+	ErrorStateCovVector Fd_buf_, Qd_buf_; ///< per state of the catch-up
+	ErrorStateCovVector chunk_F_, chunk_Q_, chunk_P_; ///< per chunk: composed transition and noise, start covariance
+
 	/// state variables
 	State StateBuffer_[N_STATE_BUFFER]; ///< EKF ringbuffer containing pretty much all info needed at time t
 	unsigned char idx_state_; ///< pointer to state buffer at most recent state
 	unsigned char idx_P_; ///< pointer to state buffer at P latest propagated
 	unsigned char idx_time_; ///< pointer to state buffer at a specific time
 
+	/// lazy re-propagation: states from idx_dirty_ to the newest one still need to be replayed after a correction
+	bool dirty_;
+	unsigned char idx_dirty_;
+	int dirty_seq_; ///< measurement sequence the dirty states get tagged with on replay
+	const static int nMinReplay_ = 2; ///< states replayed per IMU callback at least, regardless of the time budget
+
 	Eigen::Matrix<double, 3, 1> g_; ///< gravity vector
 	Eigen::Quaternion<double> initial_q_;
 
@@ -206,8 +471,10 @@ private:
 	/// correction from EKF update
 	Eigen::Matrix<double, N_STATE, 1> correction_;
 
-	/// dynamic reconfigure config
-	ssf_core::SSF_CoreConfig config_;
+	unsigned int buffer_version_; ///< incremented on every correction, invalidates measurement snapshots. Written with both locks held
+
+	/// dynamic reconfigure config, read lock-free by the filter
+	ParameterStore params_;
 
 	Eigen::Matrix<double, 3, 3> R_IW_; ///< Rot IMU->World
 	Eigen::Matrix<double, 3, 3> R_CI_; ///< Rot Camera->IMU
@@ -239,48 +506,79 @@ private:
 		NO_UP, GOOD_UP, FUZZY_UP
 	};
 
-	ros::Publisher pubState_; ///< publishes all states of the filter
-	sensor_fusion_comm::DoubleArrayStamped msgState_;
+	OutputStage output_; ///< publishes states, poses, gate statistics and transforms outside of the core mutex
+	ShmStateWriter shm_writer_; ///< newest state for co-located readers, only with ~shm_name
+	ros::Time lastIntPoseTime_; ///< stamp of the last published integrated pose
 
-	ros::Publisher pubPose_; ///< publishes 6DoF pose output
-	geometry_msgs::PoseWithCovarianceStamped msgPose_;
+	/// innovation gate, the thresholds come with the parameters
+	GateStatistics gate_stats_;
 
-	ros::Publisher pubPoseCorrected_; ///< HM: publishes 6DoF pose output, after each applyCorrection
-	geometry_msgs::PoseWithCovarianceStamped msgPoseCorrected_;
+	ros::Publisher pubPoseCrtl_; ///< publishes 6DoF pose including velocity output at IMU rate, for control loops
+	sensor_fusion_comm::ExtState msgPoseCtrl_; ///< only used by the IMU path
+	double ext_state_latency_; ///< ext_state gets predicted this far (seconds) past the newest IMU reading
 
-	ros::Publisher pubIntPose_;
-	geometry_msgs::PoseWithCovarianceStamped msgIntPose_;
+	ros::Publisher pubCorrect_; ///< publishes corrections for external state propagation
+	sensor_fusion_comm::ExtEkf msgCorrect_; ///< guarded by cov_mutex_
 
-	tf2_ros::TransformBroadcaster tf_broadcaster_;
+	ros::Subscriber subState_; ///< subscriber to external state propagation
 
-	// ros::Publisher pubPoseCrtl_; ///< publishes 6DoF pose including velocity output
-	// sensor_fusion_comm::ExtState msgPoseCtrl_;
 
-	//ros::Publisher pubCorrect_; ///< publishes corrections for external state propagation
-	//sensor_fusion_comm::ExtEkf msgCorrect_;
-
-	//ros::Subscriber subState_; ///< subscriber to external state propagation
-
-
-	//sensor_fusion_comm::ExtEkf hl_state_buf_; ///< buffer to store external propagation data
+	sensor_fusion_comm::ExtEkf hl_state_buf_; ///< buffer to store external propagation data, guarded by state_mutex_
 
 	// dynamic reconfigure
 	ReconfigureServer *reconfServer_; // hm: it is this - dynamic_reconfigure::Server<ssf_core::SSF_CoreConfig>
 	typedef boost::function<void(ssf_core::SSF_CoreConfig& config, uint32_t level)> CallbackType;
 	std::vector<CallbackType> callbacks_;
 
-	/// propagates the state with given dt
-	void propagateState(const double dt);
+	/// propagates the state at idx from the one before, replayed states (after a correction) produce no output
+	void propagateState(const unsigned char idx, bool replay = false);
+
+	/// fills msgPoseCtrl_ with state, predicted ext_state_latency_ ahead with its last IMU readings
+	void toExtState(const State & state, const ros::Time & stamp);
+
+	/// true if the nominal state at idx still needs to be replayed after a correction (lazy mode)
+	bool isDirty(unsigned char idx);
+
+	/// marks the states from idx to the newest one for lazy replay
+	void markDirty(unsigned char idx, int seq);
+
+	/// replays dirty states up to and including idx
+	/**
+	 * \param budget time budget in seconds, <= 0 for no limit
+	 * \return true if the state at idx is clean
+	 */
+	bool repropagate(unsigned char idx, double budget);
 
 	/// propagets the error state covariance
-	void predictProcessCovariance(const double dt);
+	void predictProcessCovariance(const double dt, const ProcessNoise & noise);
 
-	/// applies the correction
-	bool applyCorrection(unsigned char idx_delaystate, const ErrorState & res_delayed, double fuzzythres, std_msgs::Header msg_header);
+	/// degraded covariance propagation over the next n states with a single transition
+	void predictProcessCovarianceStride(int n, const ProcessNoise & noise);
+
+	/// computes the discrete transition Fd and process noise Qd from state idx-1 to state idx
+	/**
+	 * noise comes from the caller, so a whole catch-up uses one parameter snapshot
+	 */
+	void computeProcessModel(const unsigned char idx, const double dt, const ProcessNoise & noise,
+			ErrorStateCov & Fd, ErrorStateCov & Qd);
 
-	/// propagate covariance to a given index in the ringbuffer
+	/// propagates the covariance over the next n states as a parallel scan on covariance_pool_
+	/** one chunk per thread, see ssf_core::scanCovariance() */
+	void propagateCovarianceParallel(int n, const ProcessNoise & noise);
+
+	/// applies correction_ to the state at idx_delaystate, provided it still holds the state from delaystate_time
+	bool applyCorrection(unsigned char idx_delaystate, double delaystate_time, const ErrorState & res_delayed, double fuzzythres, std_msgs::Header msg_header);
+
+	/// propagate covariance to a given index in the ringbuffer, call with cov_mutex_ held
 	void propPToIdx(unsigned char idx);
 
+	/// chi-square test of an innovation with squared Mahalanobis distance distance and dof degrees of freedom
+	/**
+	 * updates and publishes the gate statistics.
+	 * \return true if the measurement passes the gate (or gating is disabled)
+	 */
+	bool gateInnovation(double distance, int dof, const std_msgs::Header & msg_header);
+
 	/// internal state propagation
 	/**
 	 * This function gets called on incoming imu messages an then performs
@@ -291,15 +589,39 @@ private:
 	// void imuCallbackHandler(const sensor_msgs::ImuConstPtr & msg);
 	void imuCallback(const sensor_msgs::ImuConstPtr & msg, const sensor_msgs::MagneticFieldConstPtr & msg_mag);
 
+	/// IMU and magnetometer readings from one message, no synchronizer involved
+	void visensorImuCallback(const ssf_core::visensor_imuConstPtr & msg);
+
+	/// IMU readings without magnetometer, propagation never waits for one
+	void imuOnlyCallback(const sensor_msgs::ImuConstPtr & msg);
+
+	/// keeps the latest magnetometer reading for imuOnlyCallback()
+	void magCallback(const sensor_msgs::MagneticFieldConstPtr & msg_mag);
+
+	/// fills in the IMU part of sample from msg
+	static void imuSampleFromMsg(const sensor_msgs::Imu & msg, ImuSample & sample);
+
+	/// processes sample right away or hands it to the filter thread
+	void inputImu(const ImuSample & sample);
+
+	/// state and covariance prediction with new IMU readings
+	void processImu(const ImuSample & sample);
+
 
 	/// external state propagation
 	/**
 	 * This function gets called when state prediction is performed externally,
 	 * e.g. by asctec_mav_framework. Msg has to be the latest predicted state.
-	 * Only use this OR imuCallback by remapping the topics accordingly.
+	 * Used instead of imuCallback with ~imu_input_mode external.
 	 * \sa{imuCallback}
 	 */
-	//void stateCallback(const sensor_fusion_comm::ExtEkfConstPtr & msg);
+	void stateCallback(const sensor_fusion_comm::ExtEkfConstPtr & msg);
+
+	/// takes the externally propagated state of sample for the state at idx, instead of propagateState()
+	void takeExternalState(const unsigned char idx, const ImuSample & sample);
+
+	/// sends the newest corrected state to the autopilot, relative to the last state it reported
+	void sendCorrection(const std_msgs::Header & msg_header);
 
 	/// gets called by dynamic reconfigure and calls all registered callbacks in callbacks_
 	void Config(ssf_core::SSF_CoreConfig &config, uint32_t level);
@@ -333,52 +655,96 @@ private:
 
 public:
 
-	void mutexLock(){core_mutex.lock();}
+	/// locks the whole core, i.e. blocks IMU propagation as well as covariance work and measurement updates
+	void mutexLock(){cov_mutex_.lock(); state_mutex_.lock();}
 
-	void mutexUnlock(){core_mutex.unlock();}
+	void mutexUnlock(){state_mutex_.unlock(); cov_mutex_.unlock();}
 	// some header implementations
 
 	/// main update routine called by a given sensor
+	/**
+	 * the caller must hold cov_mutex_ but not state_mutex_, i.e. go through commitMeasurement(). The
+	 * IMU path keeps propagating the nominal head in the meantime.
+	 * measurements with more rows than the error state (e.g. stacked feature residuals,
+	 * which may use dynamic-size matrices) are fused in information form, see ssf_core::ekfUpdate()
+	 */
 	template<class H_type, class Res_type, class R_type>
 		bool applyMeasurement(unsigned char idx_delaystate, const Eigen::MatrixBase<H_type>& H_delayed,
 			const Eigen::MatrixBase<Res_type> & res_delayed, const Eigen::MatrixBase<R_type>& R_delayed,
 			std_msgs::Header msg_header, double fuzzythres = 0.1)
 		{
-			EIGEN_STATIC_ASSERT_FIXED_SIZE(H_type);
-			EIGEN_STATIC_ASSERT_FIXED_SIZE(R_type);
+			EIGEN_STATIC_ASSERT(H_type::ColsAtCompileTime == N_STATE, YOU_MIXED_MATRICES_OF_DIFFERENT_SIZES);
+			SSF_ALLOCATION_GUARD_SCOPE("applyMeasurement");
 
-			// get measurements
-			if (lastImuInputsTime_.isZero())
+			double delaystate_time;
 			{
-				ROS_WARN("Measurement received but no IMU inputs are available yet.");
-				exit(-1);
-				return false;
+				std::lock_guard<std::mutex> state_lock(state_mutex_);
+
+				// get measurements
+				if (lastImuInputsTime_.isZero())
+				{
+					ROS_WARN("Measurement received but no IMU inputs are available yet.");
+					exit(-1);
+					return false;
+				}
+
+				// identifies the slot, in case new IMU readings overwrite it during the update
+				delaystate_time = StateBuffer_[idx_delaystate].time_;
 			}
 
 			// make sure we have correctly propagated cov until idx_delaystate
 			propPToIdx(idx_delaystate);
 
-			R_type S;
-			Eigen::Matrix<double, N_STATE, R_type::RowsAtCompileTime> K;
 			ErrorStateCov & P = StateBuffer_[idx_delaystate].P_;
 
-			std::cout << "P before update: " << std::endl << P.diagonal().transpose() << std::endl;
+			SSF_LOG_MATRIX(DEBUG, "P before update", P.diagonal().transpose());
+
+			const UpdateStatus status = ekfUpdate(P, H_delayed, res_delayed, R_delayed, correction_,
+				[&](double distance, int dof) {return gateInnovation(distance, dof, msg_header);});
+			if (status == UPDATE_SINGULAR)
+			{
+				SSF_LOG(WARN, "applyMeasurement(): innovation or measurement covariance not positive definite, rejecting measurement");
+				return false;
+			}
+			if (status == UPDATE_GATED)
+				return false;
+
+			SSF_LOG_MATRIX(DEBUG, "P after update", P.diagonal().transpose());
 
-			S = H_delayed * StateBuffer_[idx_delaystate].P_ * H_delayed.transpose() + R_delayed;
-			K = P * H_delayed.transpose() * S.inverse();
+			return applyCorrection(idx_delaystate, delaystate_time, correction_, fuzzythres, msg_header);
+		}
 
-			std::cout << "gain K.diagonal():" << std::endl << K.diagonal().transpose() << std::endl;
+	/// two-phase measurement update, step 2: apply a measurement prepared on a snapshot
+	/**
+	 * holds cov_mutex_ for the update only, the nominal state lock just for the slot accesses. If the buffer
+	 * got corrected since the snapshot was taken (e.g. by another sensor), H and the residual are outdated
+	 * and STALE is returned.
+	 * \param pre_update optional modification of the buffered state right before the update
+	 */
+	template<class H_type, class Res_type, class R_type>
+		CommitStatus commitMeasurement(const MeasurementSnapshot & snapshot, const Eigen::MatrixBase<H_type>& H_delayed,
+			const Eigen::MatrixBase<Res_type> & res_delayed, const Eigen::MatrixBase<R_type>& R_delayed,
+			std_msgs::Header msg_header, double fuzzythres = 0.1,
+			const boost::function<void(State&)> & pre_update = boost::function<void(State&)>())
+		{
+			std::lock_guard<std::mutex> cov_lock(cov_mutex_);
 
-			correction_ = K * res_delayed;
-			const ErrorStateCov KH = (ErrorStateCov::Identity() - K * H_delayed);
-			P = KH * P * KH.transpose() + K * R_delayed * K.transpose();
+			// corrections hold cov_mutex_, so the version cannot change anymore until we are done
+			if (snapshot.version != buffer_version_)
+				return STALE;
 
-			// make sure P stays symmetric
-			P = 0.5 * (P + P.transpose());
+			{
+				std::lock_guard<std::mutex> state_lock(state_mutex_);
 
-			std::cout << "P after update: " << std::endl << P.diagonal().transpose() << std::endl;
+				// the slot may also have been overwritten by new IMU readings after a full turn of the ringbuffer
+				if (StateBuffer_[snapshot.idx].time_ != snapshot.state.time_)
+					return STALE;
 
-			return applyCorrection(idx_delaystate, correction_, fuzzythres, msg_header);
+				if (pre_update)
+					pre_update(StateBuffer_[snapshot.idx]);
+			}
+
+			return applyMeasurement(snapshot.idx, H_delayed, res_delayed, R_delayed, msg_header, fuzzythres) ? COMMITTED : REJECTED;
 		}
 
 	/// registers dynamic reconfigure callbacks
@@ -388,7 +754,10 @@ public:
 			callbacks_.push_back(boost::bind(cb_func, p_obj, _1, _2));
 		}
 
+	/// camera-IMU calibration, on tf_static and only if it changed beyond ~tf_calibration_*_threshold
 	void broadcast_ci_transformation(const unsigned char idx, const ros::Time& timestamp, bool gotMeasurement = false);
+
+	/// world-IMU pose, at ~tf_world_imu_rate at most
 	void broadcast_iw_transformation(const unsigned char idx, const ros::Time& timestamp, bool gotMeasurement = false);
 };
 
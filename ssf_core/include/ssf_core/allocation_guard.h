@@ -0,0 +1,75 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef ALLOCATION_GUARD_H_
+#define ALLOCATION_GUARD_H_
+
+/// debugging aid for the real-time mode: aborts if a guarded scope allocates or frees heap memory
+/**
+ * Only compiled in with -DSSF_ALLOCATION_GUARD (cmake -DSSF_ALLOCATION_GUARD=ON). malloc, calloc,
+ * realloc and free get wrapped (glibc only) and count the heap operations of the thread inside a guarded scope.
+ * Scopes only start checking once the guard got armed, i.e. after warm-up. Otherwise
+ * SSF_ALLOCATION_GUARD_SCOPE compiles to nothing.
+ */
+
+#ifdef SSF_ALLOCATION_GUARD
+
+namespace ssf_core{
+
+class AllocationGuard
+{
+public:
+	/// where is reported on a violation, must be a string literal
+	explicit AllocationGuard(const char * where);
+	~AllocationGuard();
+
+	/// enables the checks of all scopes
+	static void arm();
+
+private:
+	const char * where_;
+	unsigned long allocations_; ///< heap operations of the thread when the scope was entered
+	bool checking_; ///< the guard was armed when the scope was entered
+};
+
+}; // end namespace
+
+#define SSF_ALLOCATION_GUARD_SCOPE(where) ssf_core::AllocationGuard allocation_guard_scope_(where)
+#define SSF_ALLOCATION_GUARD_ARM() ssf_core::AllocationGuard::arm()
+
+#else
+
+#define SSF_ALLOCATION_GUARD_SCOPE(where)
+#define SSF_ALLOCATION_GUARD_ARM()
+
+#endif
+
+#endif /* ALLOCATION_GUARD_H_ */
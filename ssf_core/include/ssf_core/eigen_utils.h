@@ -34,6 +34,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <Eigen/Dense>
 #include <Eigen/Geometry>
+#include <cmath>
 
 /// returns the 3D cross product skew symmetric matrix of a given 3D vector
 template<class Derived>
@@ -105,6 +106,51 @@ template<class Derived>
     }
   }
 
+/// returns the p-quantile of the standard normal distribution (P. J. Acklam's rational approximation)
+inline double normalQuantile(double p)
+{
+  static const double a[] = {-3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+                             1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00};
+  static const double b[] = {-5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+                             6.680131188771972e+01, -1.328068155288572e+01};
+  static const double c[] = {-7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                             -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00};
+  static const double d[] = {7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+                             3.754408661907416e+00};
+  const double p_low = 0.02425;
+
+  if (p <= 0)
+    return -HUGE_VAL;
+  if (p >= 1)
+    return HUGE_VAL;
+
+  if (p < p_low)
+  {
+    const double q = sqrt(-2 * log(p));
+    return (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5])
+        / ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+  }
+  if (p > 1 - p_low)
+  {
+    const double q = sqrt(-2 * log(1 - p));
+    return -(((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5])
+        / ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+  }
+  const double q = p - 0.5;
+  const double r = q * q;
+  return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q
+      / (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1);
+}
+
+/// returns the p-quantile of the chi-square distribution with dof degrees of freedom (Wilson-Hilferty approximation)
+inline double chiSquareQuantile(int dof, double p)
+{
+  const double k = dof;
+  const double h = 2.0 / (9.0 * k);
+  const double t = 1.0 - h + normalQuantile(p) * sqrt(h);
+  return t > 0 ? k * t * t * t : 0;
+}
+
 /// debug output to check misbehavior of Eigen
 template<class T>
   bool checkForNumeric(const T & vec, int size, const std::string & info)
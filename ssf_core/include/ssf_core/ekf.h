@@ -0,0 +1,257 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef EKF_H_
+#define EKF_H_
+
+#include <Eigen/Dense>
+#include <ssf_core/state.h>
+
+namespace ssf_core
+{
+
+/// process noise std. devs per axis, as calc_Q takes them
+struct ProcessNoise
+{
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	Eigen::Matrix<double, 3, 1> n_a, n_ba, n_w, n_bw, n_qwv, n_qci, n_pic;
+	double n_L;
+
+	/// the same std. dev on all axes, as the dynamic reconfigure parameters set them
+	void setConstant(double acc, double accbias, double gyr, double gyrbias, double scale, double qwv, double qci, double pic);
+};
+
+/// 0 for the error states fixed by fixed_scale, fixed_bias and fixed_calib, 1 otherwise
+ErrorState correctionMask(bool fixed_scale, bool fixed_bias, bool fixed_calib);
+
+/// outcome of kalmanUpdate() and informationUpdate()
+enum UpdateStatus
+{
+	UPDATE_APPLIED,  ///< P and the correction got updated
+	UPDATE_SINGULAR, ///< innovation or measurement covariance not positive definite, nothing changed
+	UPDATE_GATED     ///< the gate rejected the innovation, nothing changed
+};
+
+/// gate for the updates below which accepts every measurement
+struct AcceptAll
+{
+	bool operator()(double /*distance*/, int /*dof*/) const {return true;}
+};
+
+/// first order integration matrix of the JPL quaternion for the angular velocities ewold followed by ew over dt
+Eigen::Matrix<double, 4, 4> compute_delta_q(const Eigen::Matrix<double, 3, 1> &ew, const Eigen::Matrix<double, 3, 1> &ewold, double dt);
+
+/// propagates the nominal state from prev to cur with the IMU readings stored in both
+/**
+ * cur must have time_, a_m_ and w_m_ set. The states not varying during propagation are copied from prev.
+ * \param g gravity in the world frame
+ */
+void propagateNominal(const State & prev, State & cur, const Eigen::Matrix<double, 3, 1> & g);
+
+/// discrete error state transition Fd and process noise Qd from prev to cur, both propagated already
+void computeProcessModel(const State & prev, const State & cur, double dt, const Eigen::Matrix<double, 3, 1> & g,
+		const ProcessNoise & noise, ErrorStateCov & Fd, ErrorStateCov & Qd);
+
+/// adds the error state correction to the nominal state
+/**
+ * \return false if the scale went negative and got clamped to 0.1
+ */
+bool applyErrorState(State & state, const ErrorState & correction);
+
+/// propagates the covariance over n transitions P(k) = Fd_k * P(k-1) * Fd_k' + Qd_k as a parallel scan
+/**
+ * P <- Fd*P*Fd' + Qd is an affine map on P, two consecutive ones compose to
+ *   (Fd2,Qd2) o (Fd1,Qd1) = (Fd2*Fd1, Fd2*Qd1*Fd2' + Qd2).
+ * The transitions get split into n_chunks chunks. The chunks are composed in parallel, the chunk start
+ * covariances follow serially from the compositions, and finally every chunk writes out its
+ * covariances in parallel from its start covariance.
+ * \param P0 covariance before the first transition
+ * \param model model(k, Fd, Qd) computes transition k of 0..n-1, called in parallel
+ * \param P P(k) is the covariance after transition k to write to
+ * \param Fd,Qd scratch for n transitions
+ * \param chunk_F,chunk_Q,chunk_P scratch for n_chunks chunks
+ * \param pool pool.run(n_tasks, task) calls task(i) for i in 0..n_tasks-1, e.g. a WorkerPool
+ */
+template<class Model, class Output, class Pool>
+	void scanCovariance(const ErrorStateCov & P0, int n, int n_chunks, Model & model, Output & P,
+		ErrorStateCov * Fd, ErrorStateCov * Qd, ErrorStateCov * chunk_F, ErrorStateCov * chunk_Q, ErrorStateCov * chunk_P,
+		Pool & pool)
+	{
+		// 1. transition and noise of every state, composed per chunk. The last chunk's composition is not needed
+		auto compose = [&](int c)
+		{
+			const int begin = c * n / n_chunks;
+			const int end = (c + 1) * n / n_chunks;
+			for (int k = begin; k < end; k++)
+			{
+				model(k, Fd[k], Qd[k]);
+
+				if (c == n_chunks - 1)
+					continue;
+				if (k == begin)
+				{
+					chunk_F[c] = Fd[k];
+					chunk_Q[c] = Qd[k];
+				}
+				else
+				{
+					chunk_Q[c] = Fd[k] * chunk_Q[c] * Fd[k].transpose() + Qd[k];
+					chunk_F[c] = Fd[k] * chunk_F[c];
+				}
+			}
+		};
+		pool.run(n_chunks, compose);
+
+		// 2. covariance at the start of each chunk
+		chunk_P[0] = P0;
+		for (int c = 0; c < n_chunks - 1; c++)
+			chunk_P[c + 1] = chunk_F[c] * chunk_P[c] * chunk_F[c].transpose() + chunk_Q[c];
+
+		// 3. every chunk propagates its covariances from its start covariance
+		auto propagate = [&](int c)
+		{
+			const int begin = c * n / n_chunks;
+			const int end = (c + 1) * n / n_chunks;
+			const ErrorStateCov * P_prev = &chunk_P[c];
+			for (int k = begin; k < end; k++)
+			{
+				ErrorStateCov & P_k = P(k);
+				P_k = Fd[k] * (*P_prev) * Fd[k].transpose() + Qd[k];
+				P_prev = &P_k;
+			}
+		};
+		pool.run(n_chunks, propagate);
+	}
+
+/// Kalman update of P and correction for a measurement with residual res = H * error + noise(R)
+/**
+ * The innovation is factored once, gate(distance, dof) gets its squared Mahalanobis distance before
+ * anything is modified. P is updated in Joseph form.
+ */
+template<class H_type, class Res_type, class R_type, class Gate>
+	UpdateStatus kalmanUpdate(ErrorStateCov & P, const Eigen::MatrixBase<H_type>& H, const Eigen::MatrixBase<Res_type> & res,
+		const Eigen::MatrixBase<R_type>& R, ErrorState & correction, Gate gate)
+	{
+		EIGEN_STATIC_ASSERT(H_type::ColsAtCompileTime == N_STATE, YOU_MIXED_MATRICES_OF_DIFFERENT_SIZES);
+		typedef typename R_type::PlainObject S_type;
+
+		const S_type S = H * P * H.transpose() + R;
+		const Eigen::LLT<S_type> S_llt(S);
+		if (S_llt.info() != Eigen::Success)
+			return UPDATE_SINGULAR;
+		if (!gate(res.dot(S_llt.solve(res)), res.rows()))
+			return UPDATE_GATED;
+
+		// K = P * H' * S^-1, P and S are symmetric
+		const Eigen::Matrix<double, N_STATE, R_type::RowsAtCompileTime> K = S_llt.solve(H * P).transpose();
+
+		correction = K * res;
+		const ErrorStateCov KH = (ErrorStateCov::Identity() - K * H);
+		P = KH * P * KH.transpose() + K * R * K.transpose();
+
+		// make sure P stays symmetric
+		P = 0.5 * (P + P.transpose());
+
+		return UPDATE_APPLIED;
+	}
+
+/// information form update of P and correction for measurements with more rows than N_STATE
+/**
+ * With P = A*A' (A from a pivoted LDLT, so P may be singular) the update only inverts the
+ * N_STATE x N_STATE matrix Y = I + (H*A)' * R^-1 * (H*A) instead of the m x m innovation covariance:
+ *   P+ = A * Y^-1 * A',  correction = A * Y^-1 * (H*A)' * R^-1 * r
+ * and the innovation distance for the gate follows from the Woodbury identity:
+ *   r' * S^-1 * r = r' * R^-1 * r - b' * Y^-1 * b,  b = (H*A)' * R^-1 * r
+ * Apart from products linear in the measurement dimension m, the cost is bounded by N_STATE.
+ * A diagonal R is inverted element wise, a full R needs one m x m factorization.
+ */
+template<class H_type, class Res_type, class R_type, class Gate>
+	UpdateStatus informationUpdate(ErrorStateCov & P, const Eigen::MatrixBase<H_type>& H, const Eigen::MatrixBase<Res_type> & res,
+		const Eigen::MatrixBase<R_type>& R, ErrorState & correction, Gate gate)
+	{
+		EIGEN_STATIC_ASSERT(H_type::ColsAtCompileTime == N_STATE, YOU_MIXED_MATRICES_OF_DIFFERENT_SIZES);
+		typedef Eigen::Matrix<double, H_type::RowsAtCompileTime, N_STATE> HA_type;
+		typedef Eigen::Matrix<double, Res_type::RowsAtCompileTime, 1> Res_vector;
+
+		// square root factor of P
+		const Eigen::LDLT<ErrorStateCov> P_ldlt(P);
+		ErrorStateCov A = P_ldlt.matrixL();
+		A = P_ldlt.transpositionsP().transpose() * (A * P_ldlt.vectorD().cwiseMax(0).cwiseSqrt().asDiagonal());
+
+		const HA_type HA = H * A;
+		HA_type Rinv_HA;
+		Res_vector Rinv_r;
+		if (R.isDiagonal(0))
+		{
+			Rinv_HA = R.diagonal().cwiseInverse().asDiagonal() * HA;
+			Rinv_r = R.diagonal().cwiseInverse().cwiseProduct(res);
+		}
+		else
+		{
+			const Eigen::LLT<typename R_type::PlainObject> R_llt(R);
+			if (R_llt.info() != Eigen::Success)
+				return UPDATE_SINGULAR;
+			Rinv_HA = R_llt.solve(HA);
+			Rinv_r = R_llt.solve(res);
+		}
+
+		ErrorStateCov Y = ErrorStateCov::Identity();
+		Y.noalias() += HA.transpose() * Rinv_HA;
+		const Eigen::LLT<ErrorStateCov> Y_llt(Y);
+		const ErrorState b = HA.transpose() * Rinv_r;
+		const ErrorState Yinv_b = Y_llt.solve(b);
+
+		if (!gate(res.dot(Rinv_r) - b.dot(Yinv_b), res.rows()))
+			return UPDATE_GATED;
+
+		correction = A * Yinv_b;
+		P = A * Y_llt.solve(A.transpose());
+
+		// make sure P stays symmetric
+		P = 0.5 * (P + P.transpose());
+
+		return UPDATE_APPLIED;
+	}
+
+/// kalmanUpdate() or, for measurements with more rows than the error state, informationUpdate()
+template<class H_type, class Res_type, class R_type, class Gate>
+	UpdateStatus ekfUpdate(ErrorStateCov & P, const Eigen::MatrixBase<H_type>& H, const Eigen::MatrixBase<Res_type> & res,
+		const Eigen::MatrixBase<R_type>& R, ErrorState & correction, Gate gate)
+	{
+		if (res.rows() > N_STATE)
+			return informationUpdate(P, H, res, R, correction, gate);
+		return kalmanUpdate(P, H, res, R, correction, gate);
+	}
+
+}; // end namespace
+
+#endif /* EKF_H_ */
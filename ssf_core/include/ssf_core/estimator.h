@@ -0,0 +1,147 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef ESTIMATOR_H_
+#define ESTIMATOR_H_
+
+#include <ssf_core/ekf.h>
+#include <Eigen/StdVector>
+
+#include <cassert>
+#include <functional>
+#include <vector>
+
+namespace ssf_core
+{
+
+/// single threaded filter without any middleware: IMU readings and measurements in, states out through callbacks
+/**
+ * Runs the propagation and update of ekf.h on its own ringbuffer, so the filter can be used from plain C++,
+ * offline tools or other frameworks. Measurements are applied at the buffered state closest to their time,
+ * the newer states get repropagated right away. Not thread safe.
+ * SSF_Core is the ROS frontend built from the same functions, with its own buffer management on top.
+ */
+class Estimator
+{
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef std::function<void(const State &)> StateCallback;
+	typedef std::function<void(const char *)> WarningCallback;
+
+	Estimator();
+
+	/// process noise for the covariance propagation
+	void setProcessNoise(const ProcessNoise & noise) {noise_ = noise;}
+
+	/// 0 for the error states updates must not change, e.g. fixed biases or calibration. All ones by default
+	void setCorrectionMask(const ErrorState & mask) {correction_mask_ = mask;}
+
+	/// called with the newest state after every IMU reading
+	void setPropagatedCallback(const StateCallback & cb) {propagated_ = cb;}
+
+	/// called with the corrected state after every applied measurement, before the newer states get repropagated
+	void setCorrectedCallback(const StateCallback & cb) {corrected_ = cb;}
+
+	/// called when a correction had to be fixed up, e.g. a negative scale
+	void setWarningCallback(const WarningCallback & cb) {warning_ = cb;}
+
+	/// (re)starts the filter from state, which must have time_, the IMU readings and P_ set
+	/** \param g gravity in the world frame */
+	void initialize(const State & state, const Eigen::Matrix<double, 3, 1> & g);
+
+	bool initialized() const {return initialized_;}
+
+	/// propagates state and covariance with the IMU readings at time
+	/** \return false if not initialized or time is not newer than the last reading */
+	bool addImu(double time, const Eigen::Matrix<double, 3, 1> & a_m, const Eigen::Matrix<double, 3, 1> & w_m);
+
+	/// buffered state closest to time, to compute H and the residual of a measurement from
+	/** \return null if not initialized or time is older than the buffer */
+	const State * closestState(double time);
+
+	/// EKF update of the state last returned by closestState(), no addImu() calls allowed in between
+	/**
+	 * gate(distance, dof) gets the squared Mahalanobis distance of the innovation, see kalmanUpdate().
+	 */
+	template<class H_type, class Res_type, class R_type, class Gate>
+		UpdateStatus applyMeasurement(const Eigen::MatrixBase<H_type>& H, const Eigen::MatrixBase<Res_type> & res,
+			const Eigen::MatrixBase<R_type>& R, Gate gate)
+		{
+			assert(initialized_ && buffer_[idx_closest_].time_ == closest_time_);
+
+			const UpdateStatus status = ekfUpdate(buffer_[idx_closest_].P_, H, res, R, correction_, gate);
+			if (status == UPDATE_APPLIED)
+				correct(idx_closest_);
+
+			return status;
+		}
+
+	template<class H_type, class Res_type, class R_type>
+		UpdateStatus applyMeasurement(const Eigen::MatrixBase<H_type>& H, const Eigen::MatrixBase<Res_type> & res,
+			const Eigen::MatrixBase<R_type>& R)
+		{
+			return applyMeasurement(H, res, R, AcceptAll());
+		}
+
+	/// newest state
+	const State & head() const {return buffer_[(unsigned char)(idx_head_ - 1)];}
+
+private:
+	const static int nBuffer_ = 256; ///< size of unsigned char, do not change!
+
+	std::vector<State, Eigen::aligned_allocator<State> > buffer_; ///< ringbuffer, on the heap as it is rather large
+	unsigned char idx_head_; ///< next free slot
+	int n_states_; ///< number of valid states in the buffer
+	unsigned char idx_closest_; ///< state returned by the last closestState() call
+	double closest_time_; ///< its time, to catch it getting overwritten
+
+	bool initialized_;
+	Eigen::Matrix<double, 3, 1> g_;
+	ProcessNoise noise_;
+	ErrorState correction_mask_;
+
+	ErrorState correction_;
+	ErrorStateCov Fd_, Qd_;
+
+	StateCallback propagated_, corrected_;
+	WarningCallback warning_;
+
+	/// propagates state and covariance from idx - 1 to idx
+	void propagate(unsigned char idx);
+
+	/// applies correction_ to the state at idx and repropagates the newer ones
+	void correct(unsigned char idx);
+};
+
+}; // end namespace
+
+#endif /* ESTIMATOR_H_ */
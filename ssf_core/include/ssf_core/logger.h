@@ -0,0 +1,220 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#ifndef LOGGER_H_
+#define LOGGER_H_
+
+#include <Eigen/Core>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/// log levels. Statements below SSF_LOG_MIN_LEVEL are removed at compile time, their arguments are not evaluated
+#define SSF_LOG_LEVEL_DEBUG 0
+#define SSF_LOG_LEVEL_INFO 1
+#define SSF_LOG_LEVEL_WARN 2
+#define SSF_LOG_LEVEL_ERROR 3
+
+#ifndef SSF_LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define SSF_LOG_MIN_LEVEL SSF_LOG_LEVEL_INFO
+#else
+#define SSF_LOG_MIN_LEVEL SSF_LOG_LEVEL_DEBUG
+#endif
+#endif
+
+/// logs a message, every "{}" in the format gets replaced by the next value. E.g.
+/// SSF_LOG(DEBUG, "measurement {} found state at index {}", seq, idx). The format must be a string literal
+#define SSF_LOG(level, ...) \
+	do { if (SSF_LOG_LEVEL_##level >= SSF_LOG_MIN_LEVEL) \
+		ssf_core::Logger::instance().values(SSF_LOG_LEVEL_##level, __VA_ARGS__); } while (0)
+
+/// logs a matrix expression, name must be a string literal. Also goes to the binary sink, if open
+#define SSF_LOG_MATRIX(level, name, expr) \
+	do { if (SSF_LOG_LEVEL_##level >= SSF_LOG_MIN_LEVEL) \
+		ssf_core::Logger::instance().matrix(SSF_LOG_LEVEL_##level, name, expr); } while (0)
+
+namespace ssf_core{
+
+/// asynchronous logger for the filter paths
+/**
+ * Producers only copy the raw values into a preallocated record of a bounded lock-free ring
+ * (multiple producers, one consumer) and never block, allocate or format. If the ring is full the
+ * record gets dropped and counted. A background thread formats the records to stdout/stderr and
+ * writes matrices to the binary sink.
+ *
+ * Binary sink layout, native byte order, one entry per matrix record:
+ *   int64 stamp (ns since epoch), int32 level, int32 rows, int32 cols, int32 n_values,
+ *   char name[nBinaryName] (zero padded), double values[n_values] (row-major)
+ * n_values is smaller than rows*cols if the matrix got truncated to nMaxValues.
+ */
+class Logger
+{
+public:
+	const static int nMaxValues = 64; ///< values per record, larger matrices get truncated
+	const static int nBinaryName = 48;
+
+	/// the process wide logger, starts the background thread on first use
+	static Logger & instance();
+
+	/// runtime threshold on top of SSF_LOG_MIN_LEVEL
+	void setLevel(int level){level_.store(level, std::memory_order_relaxed);}
+
+	bool enabled(int level) const {return level >= level_.load(std::memory_order_relaxed);}
+
+	/// writes matrix records to file as well, returns false if it cannot be opened
+	bool openBinarySink(const std::string & file);
+
+	template<class... Args>
+		void values(int level, const char * format, Args... args)
+		{
+			if (!enabled(level))
+				return;
+
+			const double vals[] = {0, static_cast<double>(args)...}; // leading 0 so it works without args
+			const int n = std::min<int>(sizeof...(args), nMaxValues);
+			push(level, format, 0, 0, [&](double * out) {
+				for (int i = 0; i < n; i++)
+					out[i] = vals[i + 1];
+				return n;
+			});
+		}
+
+	template<class Derived>
+		void matrix(int level, const char * name, const Eigen::MatrixBase<Derived> & m)
+		{
+			if (!enabled(level))
+				return;
+
+			push(level, name, m.rows(), m.cols(), [&](double * out) {
+				int n = 0;
+				for (int r = 0; r < m.rows(); r++)
+					for (int c = 0; c < m.cols() && n < nMaxValues; c++)
+						out[n++] = m(r, c);
+				return n;
+			});
+		}
+
+	/// records dropped because the ring was full
+	uint64_t getDropped() const {return dropped_.load(std::memory_order_relaxed);}
+
+	/// writes out everything logged so far, from the calling thread
+	void flush();
+
+	~Logger();
+
+private:
+	Logger();
+
+	struct Record
+	{
+		int64_t stamp;
+		int level;
+		const char * format; ///< string literal, so only the pointer is stored
+		int rows, cols; ///< 0 for plain values
+		int n_values;
+		double values[nMaxValues];
+	};
+
+	/// Vyukov style bounded queue cell, sequence tells producers and the consumer whose turn it is
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		Record record;
+	};
+
+	const static size_t nRing_ = 1024; ///< power of two
+
+	template<class Fill>
+		void push(int level, const char * format, int rows, int cols, Fill fill)
+		{
+			size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+			Cell * cell;
+			while (true)
+			{
+				cell = &ring_[pos & (nRing_ - 1)];
+				const size_t seq = cell->sequence.load(std::memory_order_acquire);
+				const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+				if (diff == 0)
+				{
+					if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0) // full, never wait for the consumer
+				{
+					dropped_.fetch_add(1, std::memory_order_relaxed);
+					return;
+				}
+				else
+					pos = enqueue_pos_.load(std::memory_order_relaxed);
+			}
+
+			Record & record = cell->record;
+			record.stamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::system_clock::now().time_since_epoch()).count();
+			record.level = level;
+			record.format = format;
+			record.rows = rows;
+			record.cols = cols;
+			record.n_values = fill(record.values);
+			cell->sequence.store(pos + 1, std::memory_order_release);
+		}
+
+	/// consumer side, only called with consume_mutex_ held
+	bool pop(Record & record);
+	void write(const Record & record);
+	void run();
+
+	Cell ring_[nRing_];
+	char pad0_[64];
+	std::atomic<size_t> enqueue_pos_;
+	char pad1_[64];
+	size_t dequeue_pos_;
+	std::atomic<uint64_t> dropped_;
+	uint64_t dropped_reported_;
+	std::atomic<int> level_;
+
+	std::mutex consume_mutex_; ///< between the background thread and flush(), producers never take it
+	FILE * binary_sink_;
+	std::atomic<bool> running_;
+	std::thread thread_;
+};
+
+}; // end namespace
+
+#endif /* LOGGER_H_ */
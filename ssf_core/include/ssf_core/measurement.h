@@ -44,8 +44,12 @@ protected:
 	typedef std::vector<MeasurementHandler*> Handlers;
 	Handlers handlers;
 
+	ros::NodeHandle nh_; ///< private node handle of this filter instance
+
 	ReconfigureServer *reconfServer_;
 
+	std::vector<boost::shared_ptr<ros::AsyncSpinner> > spinners_; ///< one per handler callback queue
+
 	void Config(ssf_core::SSF_CoreConfig &config, uint32_t level);
 	virtual	bool init() = 0;
 
@@ -57,11 +61,22 @@ public:
 	// Eigen::Matrix<double, 3, 1> v_vc_;
 	SSF_Core ssf_core_;
 
+	/// private node handle of this filter instance, handlers take their topics and parameters from it
+	const ros::NodeHandle & getNodeHandle(){return nh_;}
+
 	void addHandler(MeasurementHandler* handler)
 	{
 		handlers.push_back(handler);
 	}
-	Measurements();
+
+	/// starts spinning the callback queues of all handlers, with ~measurement_threads threads each
+	/** with input queues (filter thread or external scheduling) there is only one thread per handler */
+	void startSpinners();
+
+	/// external scheduling: serves the handler queues and the core once, see SSF_Core::runOnce()
+	int runOnce(int max_items);
+
+	Measurements(const ros::NodeHandle & nh = ros::NodeHandle("~"), bool external_scheduling = false);
 	virtual ~Measurements();
 };
 
@@ -71,10 +86,15 @@ class MeasurementHandler
 protected:
 	Measurements* measurements;
 
+	/// queue for the subscriptions and timers of this handler, so a slow handler cannot delay others or the IMU
+	ros::CallbackQueue callback_queue_;
+
 public:
 	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 	MeasurementHandler(Measurements* meas):measurements(meas){}
 
+	ros::CallbackQueue* getCallbackQueue(){return &callback_queue_;}
+
 	virtual ~MeasurementHandler() {}
 };
 
@@ -0,0 +1,258 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef OUTPUT_STAGE_H_
+#define OUTPUT_STAGE_H_
+
+#include <ros/ros.h>
+#include <sensor_fusion_comm/DoubleArrayStamped.h>
+#include <sensor_fusion_comm/FilterState.h>
+#include <geometry_msgs/PoseWithCovarianceStamped.h>
+#include <geometry_msgs/TransformStamped.h>
+#include <tf2_ros/transform_broadcaster.h>
+
+#include <ssf_core/state_conversions.h>
+
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+
+namespace ssf_core{
+
+/// fixed size ring which overwrites its oldest element when full. Not thread safe
+template<class T, unsigned int Size>
+class DropOldestRing
+{
+public:
+	DropOldestRing() : head_(0), count_(0) {}
+
+	/// returns the slot to fill, dropped is set if the oldest element got overwritten for it
+	T& push(bool & dropped)
+	{
+		dropped = count_ == Size;
+		if (dropped)
+			head_ = (head_ + 1) % Size;
+		else
+			count_++;
+		return buffer_[(head_ + count_ - 1) % Size];
+	}
+
+	/// copies the oldest element to item and removes it, returns false if empty
+	bool pop(T & item)
+	{
+		if (count_ == 0)
+			return false;
+		item = buffer_[head_];
+		head_ = (head_ + 1) % Size;
+		count_--;
+		return true;
+	}
+
+private:
+	T buffer_[Size];
+	unsigned int head_;
+	unsigned int count_;
+};
+
+/// publishes the filter output from a separate thread
+/**
+ * The filter only copies a compact snapshot of what it wants to publish while it holds the core mutex.
+ * Serialization and transport are done by the publisher thread on preallocated messages. Each topic
+ * has a small ring, if the output falls behind the oldest snapshots get dropped.
+ * Without the thread, the snapshots are published right away by the caller.
+ * state_out and filter_state carry the same state, filter_state in a fixed layout and, with
+ * ~filter_state_covariance, the full covariance (see state_layout.h and state_decoder.h).
+ * Topics without subscribers cost nothing: their snapshots are not even taken. Each of them can
+ * be limited to ~<topic>_max_rate (Hz, by message stamp, 0 for no limit). The latched degradation
+ * topic and the transforms are always published.
+ */
+class OutputStage
+{
+public:
+	enum PoseTopic
+	{
+		POSE, ///< newest predicted pose
+		POSE_CORRECTED, ///< pose after each correction
+		POSE_INTEGRATED, ///< pure integrated position, for debugging
+		nPoseTopics_
+	};
+
+	OutputStage();
+	~OutputStage();
+
+	/// advertises the topics, reads the rate limits and starts the publisher thread if async is set
+	void init(ros::NodeHandle & nh, bool pose_of_camera_not_imu, bool async);
+
+	/// stops the publisher thread, pending snapshots are dropped
+	void stop();
+
+	void pose(PoseTopic topic, const State & state, const ros::Time & stamp, uint32_t seq);
+	void state(const State & state, const ros::Time & stamp, uint32_t seq, double delay_measurement);
+	void gate(const ros::Time & stamp, uint32_t seq, double accepted, double rejected, double distance, double threshold);
+	void degradation(const ros::Time & stamp, int level, double miss_rate, double deadline, double shed_measurements);
+	void transform(const geometry_msgs::TransformStamped & tf_stamped);
+
+	/// latched on tf_static, for transforms that rarely change. Only the newest pending one gets sent
+	/**
+	 * All output stages of the process share one tf_static publisher, which keeps the newest transform
+	 * per child frame, so filters in the same process do not replace each other's latched transforms.
+	 */
+	void staticTransform(const geometry_msgs::TransformStamped & tf_stamped);
+
+	/// number of snapshots dropped because the output fell behind
+	unsigned long getDropped() const {return dropped_;}
+
+private:
+	const static int nStateData_ = state_layout::value::nValues + N_STATE; ///< state and covariance diagonal, see State::toStateArray()
+	const static int nRing_ = 4; ///< snapshots buffered per topic
+	const static int nTransformRing_ = 8;
+
+	/// topics with subscriber check and rate limit, the pose topics come first
+	enum ThrottledTopic
+	{
+		STATE_OUT = nPoseTopics_,
+		FILTER_STATE,
+		GATE_STATISTICS,
+		nThrottledTopics_
+	};
+
+	struct Throttle
+	{
+		double min_period; ///< seconds between two messages at least, 0 for no limit
+		ros::Time last; ///< stamp of the last accepted snapshot
+
+		Throttle() : min_period(0) {}
+	};
+
+	struct PoseSnapshot
+	{
+		ros::Time stamp;
+		uint32_t seq;
+		double p[3];
+		double q[4]; ///< w x y z
+		geometry_msgs::PoseWithCovariance::_covariance_type cov;
+
+		PoseSnapshot() : seq(0), p(), q(), cov() {}
+	};
+
+	struct StateSnapshot
+	{
+		ros::Time stamp;
+		uint32_t seq;
+		double delay_measurement;
+		double data[nStateData_];
+
+		StateSnapshot() : seq(0), delay_measurement(0), data() {}
+	};
+
+	struct FilterStateSnapshot
+	{
+		ros::Time stamp;
+		uint32_t seq;
+		double delay_measurement;
+		double data[nStateData_];
+		double covariance[state_layout::nPackedCovariance]; ///< only filled with full_covariance_
+
+		FilterStateSnapshot() : seq(0), delay_measurement(0), data(), covariance() {}
+	};
+
+	struct GateSnapshot
+	{
+		ros::Time stamp;
+		uint32_t seq;
+		double data[4]; ///< accepted, rejected, last distance, last threshold
+
+		GateSnapshot() : seq(0), data() {}
+	};
+
+	struct DegradationSnapshot
+	{
+		ros::Time stamp;
+		double data[4]; ///< level, deadline miss rate, deadline, shed measurements
+
+		DegradationSnapshot() : data() {}
+	};
+
+	bool pose_of_camera_not_imu_;
+	bool full_covariance_; ///< filter_state carries the packed covariance
+	Throttle throttle_[nThrottledTopics_]; ///< guarded by mutex_
+
+	// snapshot rings, guarded by mutex_
+	DropOldestRing<PoseSnapshot, nRing_> pose_ring_[nPoseTopics_];
+	DropOldestRing<StateSnapshot, nRing_> state_ring_;
+	DropOldestRing<FilterStateSnapshot, nRing_> filter_state_ring_;
+	DropOldestRing<GateSnapshot, nRing_> gate_ring_;
+	DropOldestRing<DegradationSnapshot, nRing_> degradation_ring_;
+	DropOldestRing<geometry_msgs::TransformStamped, nTransformRing_> transform_ring_;
+
+	// preallocated output, only used by the publishing thread
+	ros::Publisher pubPose_[nPoseTopics_];
+	geometry_msgs::PoseWithCovarianceStamped msgPose_[nPoseTopics_];
+	ros::Publisher pubState_;
+	sensor_fusion_comm::DoubleArrayStamped msgState_;
+	ros::Publisher pubFilterState_;
+	sensor_fusion_comm::FilterState msgFilterState_;
+	ros::Publisher pubGate_;
+	sensor_fusion_comm::DoubleArrayStamped msgGate_;
+	ros::Publisher pubDegradation_;
+	sensor_fusion_comm::DoubleArrayStamped msgDegradation_;
+	std::vector<geometry_msgs::TransformStamped> msgTransforms_; ///< all pending transforms go out in one batch
+	tf2_ros::TransformBroadcaster tf_broadcaster_;
+	geometry_msgs::TransformStamped static_transform_; ///< guarded by mutex_
+	bool static_transform_pending_; ///< guarded by mutex_
+	geometry_msgs::TransformStamped msgStaticTransform_;
+
+	std::mutex mutex_;
+	std::mutex publish_mutex_; ///< serializes publishing when there is no thread
+	std::condition_variable cv_;
+	std::thread thread_;
+	std::atomic<bool> running_;
+	std::atomic<unsigned long> dropped_;
+	bool pending_; ///< snapshots are waiting, guarded by mutex_
+
+	void run();
+
+	/// publishes everything buffered so far
+	void publishPending();
+
+	/// wakes up the publishing thread, or publishes right away without it. Call without mutex_ held
+	void flush();
+
+	void countDrop(bool dropped);
+
+	/// true if a snapshot of topic at stamp is over its rate limit, accepts it otherwise. Call with mutex_ held
+	bool throttled(int topic, const ros::Time & stamp);
+};
+
+}; // end namespace
+
+#endif /* OUTPUT_STAGE_H_ */
@@ -0,0 +1,111 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#ifndef PARAMETERS_H_
+#define PARAMETERS_H_
+
+#include <Eigen/Eigen>
+#include <ssf_core/SSF_CoreConfig.h>
+#include <ssf_core/ekf.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+namespace ssf_core{
+
+/// immutable snapshot of the dynamic reconfigure parameters and the quantities derived from them
+struct Parameters
+{
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	Parameters(const ssf_core::SSF_CoreConfig & config, unsigned int version);
+
+	const ssf_core::SSF_CoreConfig config;
+	const unsigned int version; ///< number of reconfigures before this snapshot, 0 for the defaults
+
+	/// process noise from the noise_* parameters
+	ProcessNoise noise;
+
+	/// 0 for the error states fixed by fixed_scale, fixed_bias and fixed_calib, 1 otherwise
+	Eigen::Matrix<double, N_STATE, 1> correction_mask;
+
+	/// time budget for lazy replay per IMU reading, 0 (i.e. replay everything) without lazy replay
+	double repropagation_budget;
+
+	/// chi-square threshold of the innovation gate for a measurement with dof degrees of freedom
+	double gateThreshold(int dof) const;
+
+private:
+	const static int nGateCache_ = 32; ///< measurement dimensions for which the gate threshold is precomputed
+	double gate_thresholds_[nGateCache_ + 1];
+};
+
+/// publishes Parameters snapshots from the reconfigure thread to the filter without locks
+/**
+ * Readers get the current snapshot with a single atomic pointer load and use it for the whole operation,
+ * so they never see a half applied reconfigure. Snapshots are never modified after publication. A replaced
+ * snapshot is freed by a later update() once it was retired for nGracePeriod_ seconds, way longer than any
+ * filter operation takes, so readers must not keep the pointer beyond the operation at hand.
+ */
+class ParameterStore
+{
+public:
+	/// starts out with the defaults of the reconfigure description
+	ParameterStore();
+
+	/// current snapshot, never null
+	const Parameters * get() const {return current_.load(std::memory_order_acquire);}
+
+	/// builds and publishes a new snapshot, may be called from any thread
+	const Parameters * update(const ssf_core::SSF_CoreConfig & config);
+
+private:
+	const static int nGracePeriod_ = 1; ///< seconds a replaced snapshot stays alive at least
+
+	struct Retired
+	{
+		std::unique_ptr<const Parameters> params;
+		std::chrono::steady_clock::time_point since;
+	};
+
+	std::mutex update_mutex_; ///< serializes writers only
+	std::unique_ptr<const Parameters> owned_; ///< the current snapshot, guarded by update_mutex_
+	std::deque<Retired> retired_; ///< replaced snapshots in the grace period, oldest first, guarded by update_mutex_
+	std::atomic<const Parameters *> current_;
+};
+
+}; // end namespace
+
+#endif /* PARAMETERS_H_ */
@@ -0,0 +1,223 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#ifndef SHM_STATE_H_
+#define SHM_STATE_H_
+
+#include <ssf_core/state_layout.h>
+
+#include <atomic>
+#include <string>
+#include <cstring>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/// newest nominal state in POSIX shared memory, for controllers on the same machine
+/**
+ * SSF_Core writes with ~shm_name set, readers in other processes only need this header
+ * (and -lrt). The region is a seqlock: the writer never waits for readers, a reader retries
+ * if it raced with an update. The segment is not unlinked, a restarted filter keeps writing
+ * into the one readers already mapped.
+ */
+namespace ssf_core{
+
+const static uint32_t nShmMagic = 0x53534631; ///< "SSF1"
+const static int nShmValues = state_layout::value::L; ///< p, v, q, b_w, b_a in the layout of state_layout.h
+
+struct ShmStateRegion
+{
+	std::atomic<uint32_t> magic; ///< nShmMagic once the writer set up the region
+	uint32_t n_values; ///< nShmValues of the writer
+	std::atomic<uint32_t> seq; ///< odd while the writer updates the state
+	uint32_t reserved;
+	double time; ///< time of the state
+	double values[nShmValues];
+};
+
+/// the state as read from the region
+struct ShmStateSample
+{
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	double time;
+	uint32_t updates; ///< states written so far, tells readers whether there is a new one
+	Eigen::Matrix<double, 3, 1> p_;
+	Eigen::Matrix<double, 3, 1> v_;
+	Eigen::Quaternion<double> q_;
+	Eigen::Matrix<double, 3, 1> b_w_;
+	Eigen::Matrix<double, 3, 1> b_a_;
+};
+
+/// maps the shared memory object name, returns nullptr on failure
+inline ShmStateRegion * mapShmState(const std::string & name, bool writer)
+{
+	const int fd = shm_open(name.c_str(), writer ? O_CREAT | O_RDWR : O_RDONLY, 0644);
+	if (fd < 0)
+		return nullptr;
+
+	if (writer && ftruncate(fd, sizeof(ShmStateRegion)) != 0)
+	{
+		::close(fd);
+		return nullptr;
+	}
+
+	void * addr = mmap(nullptr, sizeof(ShmStateRegion), writer ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd); // the mapping stays valid
+	return addr == MAP_FAILED ? nullptr : static_cast<ShmStateRegion*>(addr);
+}
+
+/// writing side, single writer only
+class ShmStateWriter
+{
+public:
+	ShmStateWriter() : region_(nullptr) {}
+	~ShmStateWriter() {close();}
+
+	/// creates or reuses the shared memory object name, e.g. "/ssf_state"
+	bool open(const std::string & name)
+	{
+		close();
+		region_ = mapShmState(name, true);
+		if (!region_)
+			return false;
+
+		// keep seq running if the region was written before, a reader may still be inside a read
+		// an odd seq means a previous writer died inside write(): make it even again, otherwise
+		// every following write would run with an even seq and readers would accept torn states
+		const uint32_t seq = region_->seq.load(std::memory_order_relaxed);
+		if (seq & 1)
+			region_->seq.store(seq + 1, std::memory_order_release);
+		region_->n_values = nShmValues;
+		region_->magic.store(nShmMagic, std::memory_order_release);
+		return true;
+	}
+
+	void close()
+	{
+		if (region_)
+			munmap(region_, sizeof(ShmStateRegion));
+		region_ = nullptr;
+	}
+
+	bool isOpen() const {return region_ != nullptr;}
+
+	/// copies time and nominal state of state (an ssf_core::State)
+	template<class StateT>
+		void write(const StateT & state)
+		{
+			const uint32_t seq = region_->seq.load(std::memory_order_relaxed);
+			region_->seq.store(seq + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+
+			region_->time = state.time_;
+			state_layout::put(region_->values + state_layout::value::p, state.p_);
+			state_layout::put(region_->values + state_layout::value::v, state.v_);
+			state_layout::put(region_->values + state_layout::value::q, state.q_);
+			state_layout::put(region_->values + state_layout::value::b_w, state.b_w_);
+			state_layout::put(region_->values + state_layout::value::b_a, state.b_a_);
+
+			region_->seq.store(seq + 2, std::memory_order_release);
+		}
+
+private:
+	ShmStateRegion * region_;
+};
+
+/// reading side, any number of readers
+class ShmStateReader
+{
+public:
+	ShmStateReader() : region_(nullptr) {}
+	~ShmStateReader() {close();}
+
+	/// maps the shared memory object name read-only, fails if the filter did not create it yet
+	bool open(const std::string & name)
+	{
+		close();
+		region_ = mapShmState(name, false);
+		return region_ != nullptr;
+	}
+
+	void close()
+	{
+		if (region_)
+			munmap(const_cast<ShmStateRegion*>(region_), sizeof(ShmStateRegion));
+		region_ = nullptr;
+	}
+
+	bool isOpen() const {return region_ != nullptr;}
+
+	/// copies the newest state to sample, returns false if there is none yet or every try raced with the writer
+	bool read(ShmStateSample & sample, int max_tries = 100) const
+	{
+		if (!region_ || region_->magic.load(std::memory_order_acquire) != nShmMagic || region_->n_values != nShmValues)
+			return false;
+
+		double time;
+		double values[nShmValues];
+		for (int i = 0; i < max_tries; i++)
+		{
+			const uint32_t seq = region_->seq.load(std::memory_order_acquire);
+			if (seq == 0)
+				return false; // nothing written yet
+			if (seq & 1)
+				continue; // update in progress
+
+			time = region_->time;
+			std::memcpy(values, region_->values, sizeof(values));
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (region_->seq.load(std::memory_order_relaxed) != seq)
+				continue;
+
+			sample.time = time;
+			sample.updates = seq / 2;
+			state_layout::get(values + state_layout::value::p, sample.p_);
+			state_layout::get(values + state_layout::value::v, sample.v_);
+			state_layout::get(values + state_layout::value::q, sample.q_);
+			state_layout::get(values + state_layout::value::b_w, sample.b_w_);
+			state_layout::get(values + state_layout::value::b_a, sample.b_a_);
+			return true;
+		}
+		return false;
+	}
+
+private:
+	const ShmStateRegion * region_;
+};
+
+}; // end namespace
+
+#endif /* SHM_STATE_H_ */
@@ -0,0 +1,99 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef SPSC_QUEUE_H_
+#define SPSC_QUEUE_H_
+
+#include <atomic>
+
+namespace ssf_core{
+
+/// bounded lock-free queue for exactly one producer and one consumer thread
+/**
+ * The producer only calls push(), the consumer only front() and pop(). Elements are
+ * preallocated, push() copies into the slot. One slot stays unused to tell full from empty.
+ */
+template<class T, unsigned int Size>
+class SpscQueue
+{
+public:
+	SpscQueue() : head_(0), tail_(0) {}
+
+	/// appends item, returns false if the queue is full
+	bool push(const T & item)
+	{
+		const unsigned int tail = tail_.load(std::memory_order_relaxed);
+		const unsigned int next = (tail + 1) % Size;
+		if (next == head_.load(std::memory_order_acquire))
+			return false;
+
+		buffer_[tail] = item;
+		tail_.store(next, std::memory_order_release);
+		return true;
+	}
+
+	/// returns the oldest element or a null pointer if empty. Stays valid until pop()
+	T* front()
+	{
+		const unsigned int head = head_.load(std::memory_order_relaxed);
+		if (head == tail_.load(std::memory_order_acquire))
+			return nullptr;
+
+		return &buffer_[head];
+	}
+
+	/// removes the oldest element, only call after front() returned one
+	void pop()
+	{
+		const unsigned int head = head_.load(std::memory_order_relaxed);
+		buffer_[head] = T(); // release resources held by the element, e.g. message pointers
+		head_.store((head + 1) % Size, std::memory_order_release);
+	}
+
+	bool empty() const
+	{
+		return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+	}
+
+private:
+	T buffer_[Size];
+
+	// keep producer and consumer index on separate cache lines
+	char pad0_[64];
+	std::atomic<unsigned int> head_; ///< next element to consume, written by the consumer
+	char pad1_[64];
+	std::atomic<unsigned int> tail_; ///< next free slot, written by the producer
+	char pad2_[64];
+};
+
+}; // end namespace
+
+#endif /* SPSC_QUEUE_H_ */
@@ -35,11 +35,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <Eigen/Dense>
 #include <Eigen/Geometry>
 #include <vector>
-#include <ssf_core/eigen_conversions.h>
-#include <sensor_fusion_comm/ExtState.h>
-#include <sensor_fusion_comm/DoubleArrayStamped.h>
-#include <geometry_msgs/PoseWithCovarianceStamped.h>
-#include <geometry_msgs/TransformStamped.h>
+#include <ssf_core/state_layout.h>
 
 #include <iostream>
 
@@ -47,10 +43,16 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 namespace ssf_core
 {
+static_assert(state_layout::error::nErrors == N_STATE, "state_layout.h does not match the error state");
+
+typedef Eigen::Matrix<double, N_STATE, 1> ErrorState;
+typedef Eigen::Matrix<double, N_STATE, N_STATE> ErrorStateCov;
+
 /**
  * This class defines the state, its associated error state covarinace and the
  * system inputs. The values in the braces determine the state's position in the
  * state vector / error state vector.
+ * It does not depend on ROS, the message conversions are in state_conversions.h.
  */
 class State
 {
@@ -91,26 +93,14 @@ public:
    */
   void reset();
 
-  /// writes the covariance corresponding to position and attitude to cov
-  void getPoseCovariance(geometry_msgs::PoseWithCovariance::_covariance_type & cov);
-
-  /// assembles a PoseWithCovarianceStamped message from the state
-  /** it does not set the header */
-  void toPoseMsg_imu(geometry_msgs::PoseWithCovarianceStamped & pose);
-  void toPoseMsg_camera(geometry_msgs::PoseWithCovarianceStamped & pose);
-
-  void toIntPoseMsg(geometry_msgs::PoseWithCovarianceStamped & pose);
-
-  /// assembles an ExtState message from the state
-  /** it does not set the header */
-  void toExtStateMsg(sensor_fusion_comm::ExtState & state);
+  /// returns the attitude of the camera in the world frame, in the optical frame convention
+  Eigen::Quaternion<double> cameraAttitude() const;
 
-  /// assembles a DoubleArrayStamped message from the state
-  /** it does not set the header */
-  void toStateMsg(sensor_fusion_comm::DoubleArrayStamped & state);
+  /// writes the state and the diagonal of its covariance to data, in the layout of state_layout.h
+  void toStateArray(double * data) const;
 
-  void toTransformMsg(geometry_msgs::TransformStamped& tf_stamped, 
-        const Eigen::Matrix<double, 3, 1> translation, const Eigen::Quaternion<double> rotation);
+  /// writes the upper triangle of P_ row by row to packed, state_layout::nPackedCovariance values
+  void toPackedCovariance(double * packed) const;
 
   friend std::ostream& operator<<(std::ostream& os, const State& state)  
   {  
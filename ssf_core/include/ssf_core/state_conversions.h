@@ -0,0 +1,68 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef STATE_CONVERSIONS_H_
+#define STATE_CONVERSIONS_H_
+
+#include <ssf_core/state.h>
+#include <ssf_core/eigen_conversions.h>
+#include <sensor_fusion_comm/ExtState.h>
+#include <sensor_fusion_comm/DoubleArrayStamped.h>
+#include <geometry_msgs/PoseWithCovarianceStamped.h>
+#include <geometry_msgs/TransformStamped.h>
+
+namespace ssf_core
+{
+
+/// writes the covariance corresponding to position and attitude of state to cov
+void getPoseCovariance(const State & state, geometry_msgs::PoseWithCovariance::_covariance_type & cov);
+
+/// assembles a PoseWithCovarianceStamped message from the state
+/** it does not set the header */
+void toPoseMsg_imu(const State & state, geometry_msgs::PoseWithCovarianceStamped & pose);
+void toPoseMsg_camera(const State & state, geometry_msgs::PoseWithCovarianceStamped & pose);
+
+void toIntPoseMsg(const State & state, geometry_msgs::PoseWithCovarianceStamped & pose);
+
+/// assembles an ExtState message from the state
+/** it does not set the header */
+void toExtStateMsg(const State & state, sensor_fusion_comm::ExtState & msg);
+
+/// assembles a DoubleArrayStamped message from the state
+/** it does not set the header */
+void toStateMsg(const State & state, sensor_fusion_comm::DoubleArrayStamped & msg);
+
+void toTransformMsg(geometry_msgs::TransformStamped& tf_stamped,
+		const Eigen::Matrix<double, 3, 1> & translation, const Eigen::Quaternion<double> & rotation);
+
+}; // end namespace
+
+#endif /* STATE_CONVERSIONS_H_ */
@@ -0,0 +1,107 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#ifndef STATE_DECODER_H_
+#define STATE_DECODER_H_
+
+#include <ssf_core/state_layout.h>
+#include <sensor_fusion_comm/FilterState.h>
+#include <sensor_fusion_comm/DoubleArrayStamped.h>
+
+/// unpacking of the filter state topics, header only so consumers just need the include path
+namespace ssf_core{
+
+/// the filter state as published, see state_layout.h
+struct DecodedState
+{
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	// same member names as in State
+#define SSF_DECODED_STATE_MEMBER(name, member, n, n_error) state_layout::FieldType<n>::type member;
+	SSF_STATE_LAYOUT(SSF_DECODED_STATE_MEMBER)
+#undef SSF_DECODED_STATE_MEMBER
+
+	Eigen::Matrix<double, state_layout::error::nErrors, state_layout::error::nErrors> P_; ///< diagonal only, unless has_covariance
+	bool has_covariance; ///< P_ holds the full covariance
+
+	double time_;
+	double delay_measurement_;
+};
+
+/// decodes the state values, the covariance diagonal and, if given, the packed covariance
+inline void decodeState(const double * values, const double * diagonal, const double * packed, DecodedState & state)
+{
+#define SSF_DECODE_FIELD(name, member, n, n_error) state_layout::get(values + state_layout::value::name, state.member);
+	SSF_STATE_LAYOUT(SSF_DECODE_FIELD)
+#undef SSF_DECODE_FIELD
+
+	state.has_covariance = packed != nullptr;
+	if (state.has_covariance)
+	{
+		state_layout::unpackCovariance(packed, state.P_);
+	}
+	else
+	{
+		state.P_.setZero();
+		for (int i = 0; i < state_layout::error::nErrors; i++)
+			state.P_(i, i) = diagonal[i];
+	}
+}
+
+/// decodes a FilterState message, returns false if it does not have the expected layout
+inline bool decodeState(const sensor_fusion_comm::FilterState & msg, DecodedState & state)
+{
+	const bool has_covariance = msg.covariance.size() == (size_t)state_layout::nPackedCovariance;
+	if (!has_covariance && !msg.covariance.empty())
+		return false;
+
+	decodeState(msg.state.data(), msg.covariance_diagonal.data(), has_covariance ? msg.covariance.data() : nullptr, state);
+	state.time_ = msg.header.stamp.toSec();
+	state.delay_measurement_ = msg.delay_measurement;
+	return true;
+}
+
+/// decodes a state_out message, returns false if it does not have the expected layout
+inline bool decodeState(const sensor_fusion_comm::DoubleArrayStamped & msg, DecodedState & state)
+{
+	if (msg.data.size() != (size_t)(state_layout::value::nValues + state_layout::error::nErrors))
+		return false;
+
+	decodeState(msg.data.data(), msg.data.data() + state_layout::value::nValues, nullptr, state);
+	state.time_ = msg.header.stamp.toSec();
+	state.delay_measurement_ = msg.delay_measurement;
+	return true;
+}
+
+}; // end namespace
+
+#endif /* STATE_DECODER_H_ */
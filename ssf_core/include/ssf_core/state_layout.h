@@ -0,0 +1,148 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#ifndef STATE_LAYOUT_H_
+#define STATE_LAYOUT_H_
+
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+
+/// the published filter state, one line per field: name, State member, number of values, error state dimensions
+/**
+ * This is the only place the layout of state_out and FilterState is spelled out. Writer (State::toStateArray())
+ * and reader (state_decoder.h) are both generated from it, so fields can't go out of sync.
+ * Quaternions are stored as w x y z.
+ */
+#define SSF_STATE_LAYOUT(FIELD) \
+	FIELD(p, p_, 3, 3) \
+	FIELD(v, v_, 3, 3) \
+	FIELD(q, q_, 4, 3) \
+	FIELD(b_w, b_w_, 3, 3) \
+	FIELD(b_a, b_a_, 3, 3) \
+	FIELD(L, L_, 1, 1) \
+	FIELD(q_wv, q_wv_, 4, 3) \
+	FIELD(q_ci, q_ci_, 4, 3) \
+	FIELD(p_ci, p_ci_, 3, 3)
+
+namespace ssf_core{
+namespace state_layout{
+
+// each field contributes its first index and, to advance the next one, its last index
+#define SSF_LAYOUT_VALUE_INDEX(name, member, n, n_error) name, name##_last = name + n - 1,
+#define SSF_LAYOUT_ERROR_INDEX(name, member, n, n_error) name, name##_last = name + n_error - 1,
+
+/// offsets into the nominal state values
+namespace value{
+enum Index { SSF_STATE_LAYOUT(SSF_LAYOUT_VALUE_INDEX) nValues };
+};
+
+/// offsets into the error state, i.e. rows and columns of the covariance
+namespace error{
+enum Index { SSF_STATE_LAYOUT(SSF_LAYOUT_ERROR_INDEX) nErrors };
+};
+
+#undef SSF_LAYOUT_VALUE_INDEX
+#undef SSF_LAYOUT_ERROR_INDEX
+
+const static int nPackedCovariance = error::nErrors * (error::nErrors + 1) / 2; ///< upper triangle incl. diagonal
+
+/// index of covariance element (row, col), row <= col, in the packed upper triangle
+inline int packedIndex(int row, int col)
+{
+	return row * error::nErrors - row * (row - 1) / 2 + (col - row);
+}
+
+/// copies the upper triangle of P row by row to packed
+template<class Derived>
+	void packCovariance(const Eigen::MatrixBase<Derived> & P, double * packed)
+	{
+		for (int row = 0; row < error::nErrors; row++)
+			for (int col = row; col < error::nErrors; col++)
+				*packed++ = P(row, col);
+	}
+
+/// restores the symmetric P from its packed upper triangle
+template<class Derived>
+	void unpackCovariance(const double * packed, Eigen::MatrixBase<Derived> & P)
+	{
+		for (int row = 0; row < error::nErrors; row++)
+			for (int col = row; col < error::nErrors; col++)
+				P(row, col) = P(col, row) = *packed++;
+	}
+
+/// C++ type of a field with N values
+template<int N> struct FieldType { typedef Eigen::Matrix<double, N, 1> type; };
+template<> struct FieldType<1> { typedef double type; };
+template<> struct FieldType<4> { typedef Eigen::Quaternion<double> type; };
+
+// writing and reading a single field
+inline void put(double * data, double value)
+{
+	data[0] = value;
+}
+
+inline void put(double * data, const Eigen::Quaternion<double> & q)
+{
+	data[0] = q.w();
+	data[1] = q.x();
+	data[2] = q.y();
+	data[3] = q.z();
+}
+
+template<int N>
+	inline void put(double * data, const Eigen::Matrix<double, N, 1> & vec)
+	{
+		for (int i = 0; i < N; i++)
+			data[i] = vec[i];
+	}
+
+inline void get(const double * data, double & value)
+{
+	value = data[0];
+}
+
+inline void get(const double * data, Eigen::Quaternion<double> & q)
+{
+	q = Eigen::Quaternion<double>(data[0], data[1], data[2], data[3]);
+}
+
+template<int N>
+	inline void get(const double * data, Eigen::Matrix<double, N, 1> & vec)
+	{
+		for (int i = 0; i < N; i++)
+			vec[i] = data[i];
+	}
+
+}; // end namespace state_layout
+}; // end namespace ssf_core
+
+#endif /* STATE_LAYOUT_H_ */
@@ -0,0 +1,100 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef WORKER_POOL_H_
+#define WORKER_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ssf_core{
+
+/// fixed set of threads running batches of indexed tasks
+/**
+ * run() hands out the task indices 0..n_tasks-1 to the workers and the calling thread and returns
+ * once all of them are done. The task is passed by reference and not copied, so running a batch
+ * does not allocate.
+ */
+class WorkerPool
+{
+public:
+	/// n_threads includes the calling thread, i.e. n_threads - 1 workers get started
+	explicit WorkerPool(int n_threads);
+	~WorkerPool();
+
+	/// number of threads working on a batch, including the caller
+	int size() const {return workers_.size() + 1;}
+
+	/// calls task(i) for i in 0..n_tasks-1, in parallel. Only one batch may run at a time
+	template<class Task>
+		void run(int n_tasks, Task & task)
+		{
+			runBatch(n_tasks, &WorkerPool::call<Task>, &task);
+		}
+
+private:
+	typedef void (*TaskFunction)(void * task, int i);
+
+	template<class Task>
+		static void call(void * task, int i)
+		{
+			(*static_cast<Task*>(task))(i);
+		}
+
+	std::vector<std::thread> workers_;
+
+	std::mutex mutex_;
+	std::condition_variable start_cv_;
+	std::condition_variable done_cv_;
+	bool running_;
+	unsigned long batch_; ///< counts the batches, workers wait for it to change
+	int pending_; ///< workers not yet done with the current batch
+
+	// current batch
+	TaskFunction function_;
+	void * task_;
+	int n_tasks_;
+	std::atomic<int> next_task_;
+
+	void runBatch(int n_tasks, TaskFunction function, void * task);
+
+	/// executes tasks of the current batch until none are left
+	void executeTasks(TaskFunction function, void * task, int n_tasks);
+
+	void work();
+};
+
+}; // end namespace
+
+#endif /* WORKER_POOL_H_ */
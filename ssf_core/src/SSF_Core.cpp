@@ -30,58 +30,355 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include <ssf_core/SSF_Core.h>
-#include "calcQ.h"
 #include <ssf_core/eigen_utils.h>
 
 #include <cassert>
+#include <chrono>
+#include <cstring>
+#include <pthread.h>
+#include <sys/mman.h>
 
 namespace ssf_core
 {
-SSF_Core::SSF_Core() : imu_received_(0), mag_received_(0)
+
+/// sets SCHED_FIFO with priority (if > 0) and pins to cpu (if >= 0) for the calling thread
+static void setThreadScheduling(int priority, int cpu, const char * name)
+{
+	if (priority > 0)
+	{
+		sched_param param;
+		param.sched_priority = priority;
+		const int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (err)
+			ROS_WARN("%s thread: could not set SCHED_FIFO priority %d: %s", name, priority, strerror(err));
+	}
+
+	if (cpu >= 0)
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		const int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		if (err)
+			ROS_WARN("%s thread: could not pin to CPU %d: %s", name, cpu, strerror(err));
+	}
+}
+
+SSF_Core::SSF_Core(const ros::NodeHandle & nh, bool external_scheduling) : nh_(nh), external_scheduling_(external_scheduling)
+	, imu_cache_idx_(0), last_am_(0, 0, 0), last_wm_(0, 0, 0), closest_state_started_(false)
+	, ci_pre_measurement_(true), iw_pre_measurement_(true), ci_seq_(0), iw_seq_(0)
+	, imu_received_(0), mag_received_(0)
 	, exact_sync_(ExactPolicy(N_STATE_BUFFER),subImu_,subMag_) , global_start_(0) , lastImuInputsTime_(ros::Time(0)), isImuCacheReady(false)
 {
 	/// ros stuff
-	ros::NodeHandle nh_local("~");
+	ros::NodeHandle nh_local(nh_);
+
+	nh_local.param("tf_prefix", tf_prefix_, std::string(""));
+	nh_local.param("tf_calibration_position_threshold", tf_calib_position_threshold_, 1e-3);
+	nh_local.param("tf_calibration_angle_threshold", tf_calib_angle_threshold_, 1e-3);
+	double tf_world_imu_rate;
+	nh_local.param("tf_world_imu_rate", tf_world_imu_rate, 0.0);
+	tf_world_imu_period_ = tf_world_imu_rate > 0 ? 1.0 / tf_world_imu_rate : 0;
 
 	nh_local.param("pose_of_camera_not_imu",_is_pose_of_camera_not_imu, false);
 
 	ROS_WARN_STREAM("Output is set to pose of " << ( _is_pose_of_camera_not_imu ? "CAMERA" : "IMU"));
 
-	pubState_ = nh_local.advertise<sensor_fusion_comm::DoubleArrayStamped> ("state_out", 3);
-	//pubCorrect_ = nh.advertise<sensor_fusion_comm::ExtEkf> ("correction", 1);
-	pubPose_ = nh_local.advertise<geometry_msgs::PoseWithCovarianceStamped> ("pose", 3);
-	pubPoseCorrected_ = nh_local.advertise<geometry_msgs::PoseWithCovarianceStamped> ("pose_corrected", 3);
-	pubIntPose_ = nh_local.advertise<geometry_msgs::PoseWithCovarianceStamped> ("pose_integrated", 3);
-	//pubPoseCrtl_ = nh.advertise<sensor_fusion_comm::ExtState> ("ext_state", 1);
+	// state_out, pose, pose_corrected, pose_integrated and gate_statistics are published by the output stage
+	bool async_output;
+	nh_local.param("async_output", async_output, !external_scheduling_);
+	output_.init(nh_local, _is_pose_of_camera_not_imu, async_output);
 
-	msgState_.data.resize(nFullState_ + N_STATE, 0);
+	// newest state in shared memory for controllers on the same machine, see shm_state.h
+	std::string shm_name;
+	nh_local.param("shm_name", shm_name, std::string(""));
+	if (!shm_name.empty())
+	{
+		if (shm_writer_.open(shm_name))
+			ROS_INFO("writing the state to shared memory %s", shm_name.c_str());
+		else
+			ROS_WARN("could not set up shared memory %s: %s", shm_name.c_str(), strerror(errno));
+	}
+	// ext_state is published straight from the IMU path, without the output stage thread in between
+	pubPoseCrtl_ = nh_local.advertise<sensor_fusion_comm::ExtState> ("ext_state", 1);
+	nh_local.param("ext_state_latency", ext_state_latency_, 0.0);
+
+	gate_stats_.accepted = 0;
+	gate_stats_.rejected = 0;
+	gate_stats_.last_distance = 0;
+	gate_stats_.last_threshold = 0;
+	buffer_version_ = 0;
+
+	// all IMU input callbacks share imu_callback_queue_, which is only ever spun by one thread at a time
+	ros::NodeHandle nh_imu(nh_);
+	nh_imu.setCallbackQueue(&imu_callback_queue_);
+	nh_local.param("imu_input_mode", imu_input_mode_, std::string("synchronized"));
+	last_mag_.setZero();
+	external_propagation_ = imu_input_mode_ == "external";
+	if (external_propagation_)
+	{
+		// high rate propagation runs on the autopilot, this side only does the updates
+		msgCorrect_.state.resize(HLI_EKF_STATE_SIZE, 0);
+		hl_state_buf_.state.resize(HLI_EKF_STATE_SIZE, 0);
+		pubCorrect_ = nh_local.advertise<sensor_fusion_comm::ExtEkf> ("correction", 1);
+		subState_ = nh_imu.subscribe("hl_state_input", 20, &SSF_Core::stateCallback, this);
+	}
+	else if (imu_input_mode_ == "visensor")
+	{
+		subImuDirect_ = nh_imu.subscribe("imu_state_input", 20, &SSF_Core::visensorImuCallback, this);
+	}
+	else if (imu_input_mode_ == "imu_only")
+	{
+		subImuDirect_ = nh_imu.subscribe("imu_state_input", 20, &SSF_Core::imuOnlyCallback, this);
+		subMagDirect_ = nh_imu.subscribe("mag_state_input", 20, &SSF_Core::magCallback, this);
+	}
+	else
+	{
+		if (imu_input_mode_ != "synchronized")
+			ROS_WARN("unknown imu_input_mode %s, using synchronized", imu_input_mode_.c_str());
+		imu_input_mode_ = "synchronized";
 
-	subImu_.subscribe(nh_local,"imu_state_input", 20);
-	subMag_.subscribe(nh_local,"mag_state_input", 20);
+		subImu_.subscribe(nh_imu,"imu_state_input", 20);
+		subMag_.subscribe(nh_imu,"mag_state_input", 20);
 
-	subImu_.registerCallback(boost::bind(SSF_Core::increment, &imu_received_));
-	subMag_.registerCallback(boost::bind(SSF_Core::increment, &mag_received_));
-	check_synced_timer_ = nh_local.createWallTimer(ros::WallDuration(5.0), boost::bind(&SSF_Core::checkInputsSynchronized, this));
+		subImu_.registerCallback(boost::bind(SSF_Core::increment, &imu_received_));
+		subMag_.registerCallback(boost::bind(SSF_Core::increment, &mag_received_));
+		check_synced_timer_ = nh_local.createWallTimer(ros::WallDuration(5.0), boost::bind(&SSF_Core::checkInputsSynchronized, this));
 
-	exact_sync_.registerCallback(boost::bind(&SSF_Core::imuCallback, this, _1, _2));
-	
+		exact_sync_.registerCallback(boost::bind(&SSF_Core::imuCallback, this, _1, _2));
+	}
+	ROS_INFO("IMU input mode: %s", imu_input_mode_.c_str());
 
 	qvw_inittimer_ = 1;
 
+	// debug output of the filter paths goes through the asynchronous logger
+	std::string log_level, log_binary_file;
+	nh_local.param("log_level", log_level, std::string("debug"));
+	nh_local.param("log_binary_file", log_binary_file, std::string(""));
+	Logger & logger = Logger::instance();
+	logger.setLevel(log_level == "error" ? SSF_LOG_LEVEL_ERROR : log_level == "warn" ? SSF_LOG_LEVEL_WARN
+			: log_level == "info" ? SSF_LOG_LEVEL_INFO : SSF_LOG_LEVEL_DEBUG);
+	if (!log_binary_file.empty() && !logger.openBinarySink(log_binary_file))
+		ROS_WARN("could not open the binary log %s", log_binary_file.c_str());
+
+	// real-time mode, the state buffer and all queues are fixed size members already
+	nh_local.param("realtime", realtime_, false);
+	nh_local.param("filter_thread_priority", filter_thread_priority_, 0);
+	nh_local.param("filter_thread_cpu", filter_thread_cpu_, -1);
+	n_warmup_ = 0;
+	if (realtime_)
+	{
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+			ROS_WARN("realtime mode: could not lock memory: %s", strerror(errno));
+		ROS_INFO("realtime mode: filter thread priority %d, cpu %d", filter_thread_priority_, filter_thread_cpu_);
+	}
+
+	// covariance catch-up after delayed corrections, on several cores if requested
+	int covariance_threads;
+	nh_local.param("covariance_threads", covariance_threads, 1);
+	if (covariance_threads > 1)
+	{
+		covariance_pool_.reset(new WorkerPool(covariance_threads));
+		Fd_buf_.resize(N_STATE_BUFFER);
+		Qd_buf_.resize(N_STATE_BUFFER);
+		chunk_F_.resize(covariance_threads);
+		chunk_Q_.resize(covariance_threads);
+		chunk_P_.resize(covariance_threads);
+	}
+
+	// overload protection
+	nh_local.param("imu_deadline", imu_deadline_, 0.0);
+	nh_local.param("max_degradation", max_degradation_, (int)DEFER_REPLAY);
+	max_degradation_ = std::max((int)NOMINAL, std::min((int)DEFER_REPLAY, max_degradation_));
+	imu_period_ = 0;
+	deadline_miss_rate_ = 0;
+	degradation_samples_ = 0;
+	degradation_ = NOMINAL;
+	shed_measurements_ = 0;
+
+	// with the filter thread, ROS callbacks only queue their inputs
+	n_measurement_sources_ = 0;
+	filter_running_ = false;
+	input_pending_ = false;
+	bool use_filter_thread;
+	nh_local.param("use_filter_thread", use_filter_thread, true);
+	if (use_filter_thread && !external_scheduling_)
+	{
+		filter_running_ = true;
+		filter_thread_ = std::thread(&SSF_Core::filterLoop, this);
+	}
+
 	//register dyn config list
 	registerCallback(&SSF_Core::DynConfig, this);
 
 	// set call back for reconfigure server should come last, so DynConfig is called for initialisation
-	reconfServer_ = new ReconfigureServer(ros::NodeHandle("~"));
+	reconfServer_ = new ReconfigureServer(nh_local);
 	ReconfigureServer::CallbackType f = boost::bind(&SSF_Core::Config, this, _1, _2);
 	reconfServer_->setCallback(f);
+
+	// IMU readings get spun on their own, everything else stays on the global queue
+	int imu_spinner_priority;
+	nh_local.param("imu_spinner_priority", imu_spinner_priority, 0);
+	imu_spinning_ = true;
+	if (!external_scheduling_)
+		imu_spinner_thread_ = std::thread(&SSF_Core::spinImu, this, imu_spinner_priority);
 }
 
 SSF_Core::~SSF_Core()
 {
+	if (imu_spinner_thread_.joinable())
+	{
+		imu_spinning_ = false;
+		imu_spinner_thread_.join();
+	}
+
+	if (filter_thread_.joinable())
+	{
+		filter_running_ = false;
+		notifyFilter();
+		filter_thread_.join();
+	}
+
 	delete reconfServer_;
 }
 
+int SSF_Core::addMeasurementSource(int priority)
+{
+	const int source = n_measurement_sources_;
+	if (source == nMaxMeasurementSources_)
+	{
+		ROS_ERROR("addMeasurementSource(): too many measurement sources");
+		return -1;
+	}
+
+	measurement_queues_[source].reset(new MeasurementQueue);
+	measurement_priority_[source] = priority;
+	measurement_count_[source] = 0;
+	n_measurement_sources_ = source + 1; // publishes the queue to the filter thread
+	return source;
+}
+
+void SSF_Core::postMeasurement(int source, const ros::Time & stamp, MeasurementCallback handler, void * context,
+		const boost::shared_ptr<const void> & msg)
+{
+	if (!usesInputQueues() || source < 0)
+	{
+		if (source < 0 || !shedMeasurement(source))
+			handler(context, msg);
+		return;
+	}
+
+	MeasurementEvent event;
+	event.stamp = stamp;
+	event.handler = handler;
+	event.context = context;
+	event.msg = msg;
+	if (!measurement_queues_[source]->push(event))
+		ROS_WARN_THROTTLE(1, "measurement queue %d full, dropping measurement", source);
+	notifyFilter();
+}
+
+void SSF_Core::spinImu(int priority)
+{
+	setThreadScheduling(priority, -1, "IMU spinner");
+
+	ros::NodeHandle nh;
+	while (imu_spinning_ && nh.ok())
+		imu_callback_queue_.callAvailable(ros::WallDuration(0.01));
+}
+
+int SSF_Core::runOnce(int max_items)
+{
+	imu_callback_queue_.callAvailable(ros::WallDuration(0));
+
+	int n = 0;
+	while (n < max_items && processPendingInput())
+		n++;
+	return n;
+}
+
+void SSF_Core::notifyFilter()
+{
+	if (external_scheduling_)
+	{
+		if (input_notify_)
+			input_notify_();
+		return;
+	}
+
+	// set under the mutex, so a push right after the filter thread found the queues empty is not lost
+	{
+		std::lock_guard<std::mutex> lock(filter_wait_mutex_);
+		input_pending_ = true;
+	}
+	filter_cv_.notify_one();
+}
+
+void SSF_Core::filterLoop()
+{
+	setThreadScheduling(filter_thread_priority_, filter_thread_cpu_, "filter");
+
+	if (realtime_)
+	{
+		// fault in the stack while memory is locked, so the hot path does not page fault on it later
+		volatile char stack[256 * 1024];
+		for (size_t i = 0; i < sizeof(stack); i += 4096)
+			stack[i] = 0;
+	}
+
+	while (filter_running_)
+	{
+		if (processPendingInput())
+			continue;
+
+		// input_pending_ may be left over from inputs processed already, which costs one more pass only
+		std::unique_lock<std::mutex> lock(filter_wait_mutex_);
+		filter_cv_.wait_for(lock, std::chrono::milliseconds(10), [this]{return input_pending_ || !filter_running_;});
+		input_pending_ = false;
+	}
+}
+
+bool SSF_Core::processPendingInput()
+{
+	// oldest measurement over all sources
+	int meas_source = -1;
+	MeasurementEvent * meas = nullptr;
+	const int n_sources = n_measurement_sources_;
+	for (int i = 0; i < n_sources; i++)
+	{
+		MeasurementEvent * event = measurement_queues_[i]->front();
+		if (event && (!meas || event->stamp < meas->stamp))
+		{
+			meas = event;
+			meas_source = i;
+		}
+	}
+
+	ImuSample * imu = imu_queue_.front();
+
+	// IMU readings up to the measurement time come first
+	if (imu && (!meas || imu->stamp <= meas->stamp))
+	{
+		processImu(*imu);
+		trackDeadline(*imu);
+		imu_queue_.pop();
+		return true;
+	}
+
+	if (!meas)
+		return false;
+
+	// the measurement needs the state propagated up to its time, otherwise wait for more IMU readings.
+	// Before the filter is running, the handlers decide what to do with it
+	if (!global_start_.isZero() && lastImuInputsTime_ < meas->stamp && !imu)
+		return false;
+
+	if (!shedMeasurement(meas_source))
+		meas->handler(meas->context, meas->msg);
+	measurement_queues_[meas_source]->pop();
+	return true;
+}
+
 void SSF_Core::initialize(const Eigen::Matrix<double, 3, 1> & p, const Eigen::Matrix<double, 3, 1> & v,
 													const Eigen::Quaternion<double> & q, const Eigen::Matrix<double, 3, 1> & b_w,
 													const Eigen::Matrix<double, 3, 1> & b_a, const double & L,
@@ -91,6 +388,9 @@ void SSF_Core::initialize(const Eigen::Matrix<double, 3, 1> & p, const Eigen::Ma
 													const Eigen::Quaternion<double> & q_ci, const Eigen::Matrix<double, 3, 1> & p_ci)
 {
 
+	std::lock_guard<std::mutex> cov_lock(cov_mutex_);
+	std::lock_guard<std::mutex> state_lock(state_mutex_);
+
 	// init state buffer
 	for (int i = 0; i < N_STATE_BUFFER; i++)
 	{
@@ -100,6 +400,9 @@ void SSF_Core::initialize(const Eigen::Matrix<double, 3, 1> & p, const Eigen::Ma
 	idx_state_ = 0;
 	idx_P_ = 0;
 	idx_time_ = 0;
+	idx_dirty_ = 0;
+	dirty_ = false;
+	buffer_version_++;
 
 	State & state = StateBuffer_[idx_state_];
 	state.p_ = p;
@@ -117,8 +420,7 @@ void SSF_Core::initialize(const Eigen::Matrix<double, 3, 1> & p, const Eigen::Ma
 	state.p_int_ = p; // this is the pure imu integration, without update
 	state.v_int_ = v;
 
-	msgIntPose_.header.seq = 0;
-	msgIntPose_.header.stamp = ros::Time(0);
+	lastIntPoseTime_ = ros::Time(0);
 	state.w_m_ = w_m;
 	state.a_m_ = a_m;
 	state.m_m_ = m_m;
@@ -139,6 +441,34 @@ void SSF_Core::initialize(const Eigen::Matrix<double, 3, 1> & p, const Eigen::Ma
 
 	ROS_INFO_STREAM("State[" << (int)idx_state_ << "] initialised!");
 
+	// the autopilot starts over from the initial state
+	if (external_propagation_)
+	{
+		msgCorrect_.header.stamp = ros::Time::now();
+		msgCorrect_.header.seq = 0;
+		msgCorrect_.angular_velocity.x = msgCorrect_.angular_velocity.y = msgCorrect_.angular_velocity.z = 0;
+		msgCorrect_.linear_acceleration.x = msgCorrect_.linear_acceleration.y = msgCorrect_.linear_acceleration.z = 0;
+		msgCorrect_.state[0] = state.p_[0];
+		msgCorrect_.state[1] = state.p_[1];
+		msgCorrect_.state[2] = state.p_[2];
+		msgCorrect_.state[3] = state.v_[0];
+		msgCorrect_.state[4] = state.v_[1];
+		msgCorrect_.state[5] = state.v_[2];
+		msgCorrect_.state[6] = state.q_.w();
+		msgCorrect_.state[7] = state.q_.x();
+		msgCorrect_.state[8] = state.q_.y();
+		msgCorrect_.state[9] = state.q_.z();
+		msgCorrect_.state[10] = state.b_w_[0];
+		msgCorrect_.state[11] = state.b_w_[1];
+		msgCorrect_.state[12] = state.b_w_[2];
+		msgCorrect_.state[13] = state.b_a_[0];
+		msgCorrect_.state[14] = state.b_a_[1];
+		msgCorrect_.state[15] = state.b_a_[2];
+		msgCorrect_.flag = sensor_fusion_comm::ExtEkf::initialization;
+		pubCorrect_.publish(msgCorrect_);
+		hl_state_buf_.header.stamp = ros::Time(0); // no corrections until the autopilot reported a state again
+	}
+
 	// increase state pointers
 	idx_state_++;
 	idx_P_++;
@@ -148,25 +478,108 @@ void SSF_Core::imuCallback(const sensor_msgs::ImuConstPtr & msg, const sensor_ms
 // void SSF_Core::imuCallback(const ssf_core::visensor_imuConstPtr & msg)
 {
 	all_received_++;
-	static int imuCacheIdx = 0;
 
+	ImuSample sample;
+	imuSampleFromMsg(*msg, sample);
+	sample.m_m_ << msg_mag->magnetic_field.x, msg_mag->magnetic_field.y, msg_mag->magnetic_field.z;
+	inputImu(sample);
+}
+
+void SSF_Core::visensorImuCallback(const ssf_core::visensor_imuConstPtr & msg)
+{
+	ImuSample sample;
+	sample.received = std::chrono::steady_clock::now();
+	sample.stamp = msg->header.stamp;
+	sample.seq = msg->header.seq;
+	sample.a_m_ << msg->linear_acceleration.x, msg->linear_acceleration.y, msg->linear_acceleration.z;
+	sample.w_m_ << msg->angular_velocity.x, msg->angular_velocity.y, msg->angular_velocity.z;
+	sample.m_m_ << msg->magnetometer.x, msg->magnetometer.y, msg->magnetometer.z;
+	sample.q_m_ = Eigen::Quaternion<double>(msg->orientation.w, msg->orientation.x, msg->orientation.y, msg->orientation.z);
+	inputImu(sample);
+}
+
+void SSF_Core::imuOnlyCallback(const sensor_msgs::ImuConstPtr & msg)
+{
+	ImuSample sample;
+	imuSampleFromMsg(*msg, sample);
+	sample.m_m_ = last_mag_; // zero until the first magnetometer reading, the initialisation then assumes a default heading
+	inputImu(sample);
+}
+
+void SSF_Core::magCallback(const sensor_msgs::MagneticFieldConstPtr & msg_mag)
+{
+	last_mag_ << msg_mag->magnetic_field.x, msg_mag->magnetic_field.y, msg_mag->magnetic_field.z;
+}
+
+void SSF_Core::stateCallback(const sensor_fusion_comm::ExtEkfConstPtr & msg)
+{
+	ImuSample sample;
+	sample.received = std::chrono::steady_clock::now();
+	sample.stamp = msg->header.stamp;
+	sample.seq = msg->header.seq;
+	sample.a_m_ << msg->linear_acceleration.x, msg->linear_acceleration.y, msg->linear_acceleration.z;
+	sample.w_m_ << msg->angular_velocity.x, msg->angular_velocity.y, msg->angular_velocity.z;
+	sample.m_m_.setZero();
+	sample.q_m_.setIdentity();
+
+	// state propagation is made externally, so we read the actual state. Otherwise (ignore_state or garbage)
+	// the readings get propagated here
+	if (msg->flag == sensor_fusion_comm::ExtEkf::current_state && msg->state.size() >= 10
+			&& checkForNumeric(msg->state, 10, "external state p,v,q"))
+	{
+		sample.external = true;
+		sample.p_ << msg->state[0], msg->state[1], msg->state[2];
+		sample.v_ << msg->state[3], msg->state[4], msg->state[5];
+		sample.q_ = Eigen::Quaternion<double>(msg->state[6], msg->state[7], msg->state[8], msg->state[9]);
+		sample.q_.normalize();
+		sample.q_m_ = sample.q_; // the autopilot's attitude, in place of the IMU's internal one
+	}
+	inputImu(sample);
+}
+
+void SSF_Core::imuSampleFromMsg(const sensor_msgs::Imu & msg, ImuSample & sample)
+{
+	sample.received = std::chrono::steady_clock::now();
+	sample.stamp = msg.header.stamp;
+	sample.seq = msg.header.seq;
+	sample.a_m_ << msg.linear_acceleration.x, msg.linear_acceleration.y, msg.linear_acceleration.z;
+	sample.w_m_ << msg.angular_velocity.x, msg.angular_velocity.y, msg.angular_velocity.z;
+	sample.q_m_ = Eigen::Quaternion<double>(msg.orientation.w, msg.orientation.x, msg.orientation.y, msg.orientation.z);
+}
+
+void SSF_Core::inputImu(const ImuSample & sample)
+{
+	if (!usesInputQueues())
+	{
+		processImu(sample);
+		trackDeadline(sample);
+		return;
+	}
+
+	if (!imu_queue_.push(sample))
+		ROS_WARN_THROTTLE(1, "IMU queue full, filter thread falls behind. Dropping IMU readings");
+	notifyFilter();
+}
+
+void SSF_Core::processImu(const ImuSample & sample)
+{
 	struct ImuInputsCache* imuInputsCache_ptr;
 
-	imuInputsCache_ptr = &imuInputsCache[imuCacheIdx%imuInputsCache_size];
-	imuInputsCache_ptr->seq = imuCacheIdx;
-	imuInputsCache_ptr->a_m_ << msg->linear_acceleration.x, msg->linear_acceleration.y, msg->linear_acceleration.z;
-	imuInputsCache_ptr->w_m_ << msg->angular_velocity.x, msg->angular_velocity.y, msg->angular_velocity.z;
-	imuInputsCache_ptr->m_m_ << msg_mag->magnetic_field.x, msg_mag->magnetic_field.y, msg_mag->magnetic_field.z;
-	imuInputsCache_ptr->q_m_ = Eigen::Quaternion<double>(msg->orientation.w, msg->orientation.x, msg->orientation.y, msg->orientation.z); 
+	imuInputsCache_ptr = &imuInputsCache[imu_cache_idx_%imuInputsCache_size];
+	imuInputsCache_ptr->seq = imu_cache_idx_;
+	imuInputsCache_ptr->a_m_ = sample.a_m_;
+	imuInputsCache_ptr->w_m_ = sample.w_m_;
+	imuInputsCache_ptr->m_m_ = sample.m_m_;
+	imuInputsCache_ptr->q_m_ = sample.q_m_;
 
 	// make sure the q from IMU measurement is valid
 	assert( fabs(imuInputsCache_ptr->q_m_.norm() - 1.0) < 1e-2 );
 	imuInputsCache_ptr->q_m_.normalize();
 
-	if (imuCacheIdx == imuInputsCache_size - 1)
+	if (imu_cache_idx_ == imuInputsCache_size - 1)
 		isImuCacheReady = true;
 
-	imuCacheIdx++;
+	imu_cache_idx_++;
 
 	if (imuInputsCache_ptr->a_m_.norm() > 80)
 	{
@@ -182,42 +595,39 @@ void SSF_Core::imuCallback(const sensor_msgs::ImuConstPtr & msg, const sensor_ms
 	}
 		
 
-	////////////////////////////////////////////////////////
-	////////////////////////////////////////////////////////
+	////////////////////////////////////////////////////////////
+	///// Mutex start: nominal head only, covariance work happens below
+	////////////////////////////////////////////////////////////
+
+	std::unique_lock<std::mutex> state_lock(state_mutex_);
 
 	if (lastImuInputsTime_.isZero())
 		ROS_INFO("imuCallback(): First IMU inputs received!");
 	
 	// keep track of the last input time
-	lastImuInputsTime_ = msg->header.stamp;
+	lastImuInputsTime_ = sample.stamp;
 
 	if (global_start_.isZero()) // enter calibration mode, not ekf mode yet
 	{
-		StateBuffer_[0].time_ = msg->header.stamp.toSec();
+		StateBuffer_[0].time_ = sample.stamp.toSec();
 		ROS_WARN_THROTTLE(1,"IMU data received but global_start_ is yet to be initialised, setting initial timestamp to most recent IMU readings");
 		return; // // early abort // //
-	}else if (global_start_ > msg->header.stamp)
+	}else if (global_start_ > sample.stamp)
 	{
 		ROS_WARN_THROTTLE(1,"IMU data arrives before global start time.");
 		return;
 	}
 
-	////////////////////////////////////////////////////////////
-	///// Mutex start
-	////////////////////////////////////////////////////////////
-
-	mutexLock();
-
 	// construct new input state
-	StateBuffer_[idx_state_].time_ = msg->header.stamp.toSec();
+	StateBuffer_[idx_state_].time_ = sample.stamp.toSec();
 
 	// std::cout << "msg->header.stamp = " << msg->header.stamp.toNSec() << ", state = " << (unsigned int)idx_state_ << std::endl;
 
 	// get inputs
-	StateBuffer_[idx_state_].a_m_ << msg->linear_acceleration.x, msg->linear_acceleration.y, msg->linear_acceleration.z;
-	StateBuffer_[idx_state_].w_m_ << msg->angular_velocity.x, msg->angular_velocity.y, msg->angular_velocity.z;
-	StateBuffer_[idx_state_].m_m_ << msg_mag->magnetic_field.x, msg_mag->magnetic_field.z, msg_mag->magnetic_field.z;
-	StateBuffer_[idx_state_].q_m_ = Eigen::Quaternion<double>(msg->orientation.w, msg->orientation.x, msg->orientation.y, msg->orientation.z); 
+	StateBuffer_[idx_state_].a_m_ = sample.a_m_;
+	StateBuffer_[idx_state_].w_m_ = sample.w_m_;
+	StateBuffer_[idx_state_].m_m_ = sample.m_m_;
+	StateBuffer_[idx_state_].q_m_ = sample.q_m_;
 	StateBuffer_[idx_state_].q_m_.normalize();
 	// DEBUG
 	// StateBuffer_[idx_state_].a_m_ = StateBuffer_[(unsigned char)(idx_state_ - 1)].a_m_;
@@ -226,25 +636,23 @@ void SSF_Core::imuCallback(const sensor_msgs::ImuConstPtr & msg, const sensor_ms
 	//std::cout << "imuCallback()" << all_received_ << std::endl;
 
 	// remove acc spikes (TODO: find a cleaner way to do this)
-	static Eigen::Matrix<double, 3, 1> last_am = Eigen::Matrix<double, 3, 1>(0, 0, 0);
 	if (StateBuffer_[idx_state_].a_m_.norm() > 80)
 	{
 		ROS_ERROR_STREAM("IMU acceleration too large" << StateBuffer_[idx_state_].a_m_.norm() );
 		exit(-1);
-		StateBuffer_[idx_state_].a_m_ = last_am;
+		StateBuffer_[idx_state_].a_m_ = last_am_;
 	}
 	else
-		last_am = StateBuffer_[idx_state_].a_m_;
+		last_am_ = StateBuffer_[idx_state_].a_m_;
 
-	static Eigen::Matrix<double, 3, 1> last_wm = Eigen::Matrix<double, 3, 1>(0, 0, 0);
 	if (StateBuffer_[idx_state_].w_m_.norm() > 30)
 	{
 		ROS_ERROR_STREAM("IMU angular velocity too large" << StateBuffer_[idx_state_].w_m_.norm() );
 		exit(-1);
-		StateBuffer_[idx_state_].w_m_ = last_am;
+		StateBuffer_[idx_state_].w_m_ = last_wm_;
 	}
 	else
-		last_wm = StateBuffer_[idx_state_].w_m_;
+		last_wm_ = StateBuffer_[idx_state_].w_m_;
 
 
 	if (std::abs(StateBuffer_[idx_state_].time_ - StateBuffer_[(unsigned char)(idx_state_ - 1)].time_) > 0.5)
@@ -256,11 +664,25 @@ void SSF_Core::imuCallback(const sensor_msgs::ImuConstPtr & msg, const sensor_ms
 		exit(-1);
 	}
 
-	propagateState(StateBuffer_[idx_state_].time_ - StateBuffer_[(unsigned char)(idx_state_ - 1)].time_); 
-	// StateBuffer_[idx_state_] = StateBuffer_[(unsigned char)(idx_state_ - 1)];
-	// idx_state_++;
+	// lazy mode: continue the replay of a past correction within the time budget. If it does not finish,
+	// the new state gets propagated from a stale one and becomes part of the dirty range
+	if (dirty_)
+	{
+		// deferred replays (overload) get the budget as well
+		const Parameters * params = params_.get();
+		repropagate((unsigned char)(idx_state_ - 1),
+				degradation_ >= DEFER_REPLAY ? params->config.repropagation_budget : params->repropagation_budget);
+	}
+
+	if (sample.external)
+		takeExternalState(idx_state_, sample);
+	else
+		propagateState(idx_state_);
+	idx_state_++;  // hm: unsigned char, so will automatically become a ring buffer
 
-	predictProcessCovariance(StateBuffer_[idx_P_].time_ - StateBuffer_[(unsigned char)(idx_P_ - 1)].time_);
+	// everything lazily set up got touched by now, the hot path must not allocate from here on
+	if (realtime_ && n_warmup_ < nWarmup_ && ++n_warmup_ == nWarmup_)
+		SSF_ALLOCATION_GUARD_ARM();
 	// StateBuffer_[idx_P_].P_ = StateBuffer_[(unsigned char)(idx_P_ - 1)].P_;
 	// idx_P_++;
 	// HM : from here, both idx_state_ and idx_P_ INCREMENT!
@@ -269,21 +691,19 @@ void SSF_Core::imuCallback(const sensor_msgs::ImuConstPtr & msg, const sensor_ms
 
 	//predictionMade_ = true;
 
-	msgPose_.header.stamp = msg->header.stamp;
-	msgPose_.header.seq = msg->header.seq;
-
 	State &updated_state = StateBuffer_[(unsigned char)(idx_state_ - 1)];
 
-	if (_is_pose_of_camera_not_imu)
-		updated_state.toPoseMsg_camera(msgPose_);
-	else
-		updated_state.toPoseMsg_imu(msgPose_);
+	output_.pose(OutputStage::POSE, updated_state, sample.stamp, sample.seq);
+	if (shm_writer_.isOpen())
+		shm_writer_.write(updated_state);
 
-	pubPose_.publish(msgPose_);
+	const bool ext_state = pubPoseCrtl_.getNumSubscribers() > 0;
+	if (ext_state)
+		toExtState(updated_state, sample.stamp);
 
 	// publish transforms to help initialising VO
-	// broadcast_ci_transformation((unsigned char)(idx_state_ - 1),msgPose_.header.stamp);
-	// broadcast_iw_transformation((unsigned char)(idx_state_ - 1),msgPose_.header.stamp);
+	// broadcast_ci_transformation((unsigned char)(idx_state_ - 1),sample.stamp);
+	// broadcast_iw_transformation((unsigned char)(idx_state_ - 1),sample.stamp);
 
 	// std::cout << updated_state << std::endl;
 
@@ -293,70 +713,138 @@ void SSF_Core::imuCallback(const sensor_msgs::ImuConstPtr & msg, const sensor_ms
 
 	// ROS_INFO_STREAM_THROTTLE(0.5, std::endl << "predict v: " << StateBuffer_[(unsigned char)(idx_state_ - 1)].v_.transpose() 
 		// << std::endl << "predict p" << StateBuffer_[(unsigned char)(idx_state_ - 1)].p_.transpose() );
-	// msgPoseCtrl_.header = msgPose_.header;
-	// StateBuffer_[(unsigned char)(idx_state_ - 1)].toExtStateMsg(msgPoseCtrl_);
-	//pubPoseCrtl_.publish(msgPoseCtrl_);
-
 
 	//////////////////////////////////////////////////////////////
 	//////// mutex end
 	//////////////////////////////////////////////////////////////
-	mutexUnlock();
-	
-}
+	state_lock.unlock();
 
-Eigen::Matrix<double, 4, 4> compute_delta_q(const Eigen::Matrix<double, 3, 1> &ew, const Eigen::Matrix<double, 3, 1> &ewold, double dt){
+	// before any covariance work, this is the most latency sensitive output
+	if (ext_state)
+		pubPoseCrtl_.publish(msgPoseCtrl_);
 
-	typedef const Eigen::Matrix<double, 4, 4> ConstMatrix4;
-	// typedef const Eigen::Matrix<double, 3, 1> ConstVector3;
-	typedef Eigen::Matrix<double, 4, 4> Matrix4;
+	// covariance propagation: skipped while a measurement update or catch-up holds cov_mutex_. idx_P_ then
+	// stays behind and gets caught up by propPToIdx() or the next IMU readings, a few states at a time
+	std::unique_lock<std::mutex> cov_lock(cov_mutex_, std::try_to_lock);
+	if (!cov_lock.owns_lock())
+		return;
 
-	ConstMatrix4 Omega = omegaMatJPL(ew);
-	ConstMatrix4 OmegaOld = omegaMatJPL(ewold);
+	// with cov_mutex_ held, no correction can extend the dirty range, so everything before idx_clean stays clean
+	state_lock.lock();
+	const unsigned char idx_clean = dirty_ ? idx_dirty_ : idx_state_;
+	state_lock.unlock();
 
-	Eigen::Matrix<double, 3, 1>  ew_avg = (ew + ewold) / 2.0;
+	// all transitions of this catch-up use the noises of one parameter snapshot
+	const Parameters * params = params_.get();
+	const ProcessNoise & noise = params->noise;
 
-	//std::cout<< "ew_avg:" << ew_avg.transpose() << std::endl; 
+	if (degradation_ >= SKIP_COVARIANCE)
+	{
+		// overload: one transition per nCovarianceStride_ readings, the ones in between are skipped
+		for (int i = 0; i < nCovarianceCatchUp_ && (unsigned char)(idx_clean - idx_P_) >= nCovarianceStride_; i++)
+			predictProcessCovarianceStride(nCovarianceStride_, noise);
+		return;
+	}
 
-	// if (ew_avg.norm() < 0.01)
-	// 	ew_avg.setZero();
-	// else if (ew_avg.norm() < 0.03)
-	// 	ew_avg = (ew_avg.norm() - 0.01)/0.03 * ew_avg;
+	for (int i = 0; i < nCovarianceCatchUp_ && idx_P_ != idx_clean; i++)
+		predictProcessCovariance(StateBuffer_[idx_P_].time_ - StateBuffer_[(unsigned char)(idx_P_ - 1)].time_, noise);
+}
 
+void SSF_Core::trackDeadline(const ImuSample & sample)
+{
+	if (max_degradation_ == NOMINAL || global_start_.isZero())
+		return;
 
-	Matrix4 OmegaMean = omegaMatJPL(ew_avg);
+	// the default deadline follows the IMU rate
+	const double dt = (sample.stamp - last_deadline_stamp_).toSec();
+	last_deadline_stamp_ = sample.stamp;
+	if (dt > 0 && dt < 0.1)
+		imu_period_ = imu_period_ == 0 ? dt : 0.99 * imu_period_ + 0.01 * dt;
 
-	// zero order quaternion integration
-	//	cur_state.q_ = (Eigen::Matrix<double,4,4>::Identity() + 0.5*Omega*dt)*StateBuffer_[(unsigned char)(idx_state_-1)].q_.coeffs();
+	const double deadline = imu_deadline_ > 0 ? imu_deadline_ : 2 * imu_period_;
+	if (deadline <= 0)
+		return;
 
-	// first order quaternion integration, this is kind of costly and may not add a lot to the quality of propagation...
-	int div = 1;
-	Matrix4 MatExp;
-	MatExp.setIdentity();
-	OmegaMean *= 0.5 * dt;
-	for (int i = 1; i < 5; i++)
+	// time from the reception to the end of processing, i.e. including the wait in the input queue
+	const double latency = std::chrono::duration<double>(std::chrono::steady_clock::now() - sample.received).count();
+	deadline_miss_rate_ = 0.95 * deadline_miss_rate_ + 0.05 * (latency > deadline ? 1.0 : 0.0);
+
+	// escalate on sustained misses, recover one level at a time once they got rare. Every level is kept a while,
+	// so its effect shows before the next decision
+	const int level = degradation_;
+	int new_level = level;
+	if (++degradation_samples_ >= nDegradationHold_)
 	{
-		div *= i;
-		MatExp = MatExp + OmegaMean / div;
-		OmegaMean *= OmegaMean;
+		if (deadline_miss_rate_ > 0.5 && level < max_degradation_)
+			new_level = level + 1;
+		else if (deadline_miss_rate_ < 0.05 && level > NOMINAL)
+			new_level = level - 1;
 	}
 
-	// first oder quat integration matrix
-	ConstMatrix4 quat_int = MatExp + 1.0 / 48.0 * (Omega * OmegaOld - OmegaOld * Omega) * dt * dt;
+	if (new_level != level)
+	{
+		degradation_ = new_level;
+		degradation_samples_ = 0;
+		ROS_WARN("overload protection: degradation level %d, %.0f%% of the IMU readings miss their %.1f ms deadline",
+				new_level, deadline_miss_rate_ * 100, deadline * 1e3);
+	}
 
-	return quat_int;
-} 
+	if (new_level != level || (sample.stamp - last_degradation_output_).toSec() >= 1.0)
+	{
+		last_degradation_output_ = sample.stamp;
+		output_.degradation(sample.stamp, new_level, deadline_miss_rate_, deadline, shed_measurements_);
+	}
+}
 
+bool SSF_Core::shedMeasurement(int source)
+{
+	const int level = degradation_;
+	if (level < DECIMATE_MEASUREMENTS)
+		return false;
+
+	// every level above DECIMATE_MEASUREMENTS halves the rate once more, every priority step saves one halving
+	const int halvings = level - DECIMATE_MEASUREMENTS + 1 - measurement_priority_[source];
+	if (halvings <= 0)
+		return false;
+
+	if (measurement_count_[source]++ % (1u << halvings) == 0)
+		return false;
+
+	shed_measurements_++;
+	return true;
+}
 
-void SSF_Core::propagateState(const double dt)
+void SSF_Core::propagateState(const unsigned char idx, bool replay)
 {
-	// typedef const Eigen::Matrix<double, 4, 4> ConstMatrix4;
-	typedef const Eigen::Matrix<double, 3, 1> ConstVector3;
-	// typedef Eigen::Matrix<double, 4, 4> Matrix4;
+	SSF_ALLOCATION_GUARD_SCOPE("propagateState");
 
 	// get references to current and previous state
-	State & cur_state = StateBuffer_[idx_state_];
-	State & prev_state = StateBuffer_[(unsigned char)(idx_state_ - 1)];
+	State & cur_state = StateBuffer_[idx];
+	const State & prev_state = StateBuffer_[(unsigned char)(idx - 1)];
+
+	propagateNominal(prev_state, cur_state, g_);
+
+	///// PUBLISH PURE INTEGRATED STATE FOR DEBUG, not for states replayed after a correction
+	if (replay)
+		return;
+
+	ros::Time state_time;
+	state_time.fromSec(cur_state.time_);
+
+	if (state_time > lastIntPoseTime_){ // publish new stuff
+		lastIntPoseTime_ = state_time;
+		output_.pose(OutputStage::POSE_INTEGRATED, cur_state, state_time, 0);
+	}
+}
+
+void SSF_Core::takeExternalState(const unsigned char idx, const ImuSample & sample)
+{
+	State & cur_state = StateBuffer_[idx];
+	const State & prev_state = StateBuffer_[(unsigned char)(idx - 1)];
+
+	cur_state.p_ = sample.p_;
+	cur_state.v_ = sample.v_;
+	cur_state.q_ = sample.q_;
 
 	// zero props:
 	cur_state.b_w_ = prev_state.b_w_;
@@ -365,174 +853,182 @@ void SSF_Core::propagateState(const double dt)
 	cur_state.q_wv_ = prev_state.q_wv_;
 	cur_state.q_ci_ = prev_state.q_ci_;
 	cur_state.p_ci_ = prev_state.p_ci_;
+	cur_state.q_int_ = prev_state.q_int_;
+	cur_state.p_int_ = prev_state.p_int_;
+	cur_state.v_int_ = prev_state.v_int_;
 
-//  Eigen::Quaternion<double> dq;
-	Eigen::Matrix<double, 3, 1> dv, dv_int, dv_without_g, dv_without_g_int;
-	ConstVector3 ew = cur_state.w_m_ - cur_state.b_w_;
-	ConstVector3 ewold = prev_state.w_m_ - prev_state.b_w_;
-	ConstVector3 ea = cur_state.a_m_ - cur_state.b_a_; // estimated acceleration of current state
-	ConstVector3 eaold = prev_state.a_m_ - prev_state.b_a_; // estimated acceleration of previous state
+	// reference for the next correction
+	hl_state_buf_.header.stamp = sample.stamp;
+	for (int i = 0; i < 3; i++)
+	{
+		hl_state_buf_.state[i] = sample.p_[i];
+		hl_state_buf_.state[i + 3] = sample.v_[i];
+	}
+	hl_state_buf_.state[6] = sample.q_.w();
+	hl_state_buf_.state[7] = sample.q_.x();
+	hl_state_buf_.state[8] = sample.q_.y();
+	hl_state_buf_.state[9] = sample.q_.z();
+}
 
+void SSF_Core::sendCorrection(const std_msgs::Header & msg_header)
+{
+	const State & state = StateBuffer_[(unsigned char)(idx_state_ - 1)];
 
-	auto quat_int = compute_delta_q(ew,ewold,dt);
+	msgCorrect_.header.stamp = ros::Time::now();
+	msgCorrect_.header.seq = msg_header.seq;
+	msgCorrect_.angular_velocity.x = msgCorrect_.angular_velocity.y = msgCorrect_.angular_velocity.z = 0;
+	msgCorrect_.linear_acceleration.x = msgCorrect_.linear_acceleration.y = msgCorrect_.linear_acceleration.z = 0;
 
-	auto quat_int_int_ = compute_delta_q(cur_state.w_m_, prev_state.w_m_ , dt);
+	// p, v and q relative to what the autopilot reported last, it applies them to its own newest state.
+	// The biases are absolute
+	for (int i = 0; i < 3; i++)
+	{
+		msgCorrect_.state[i] = state.p_[i] - hl_state_buf_.state[i];
+		msgCorrect_.state[i + 3] = state.v_[i] - hl_state_buf_.state[i + 3];
+		msgCorrect_.state[i + 10] = state.b_w_[i];
+		msgCorrect_.state[i + 13] = state.b_a_[i];
+	}
 
-	// first oder quaternion integration
-	cur_state.q_.coeffs() = quat_int * prev_state.q_.coeffs();
-	cur_state.q_.normalize();
+	const Eigen::Quaternion<double> hl_q(hl_state_buf_.state[6], hl_state_buf_.state[7], hl_state_buf_.state[8],
+			hl_state_buf_.state[9]);
+	Eigen::Quaternion<double> dq = hl_q.inverse() * state.q_;
+	if (dq.w() < 0)
+		dq.coeffs() = -dq.coeffs();
+	msgCorrect_.state[6] = dq.w();
+	msgCorrect_.state[7] = dq.x();
+	msgCorrect_.state[8] = dq.y();
+	msgCorrect_.state[9] = dq.z();
+
+	msgCorrect_.flag = sensor_fusion_comm::ExtEkf::state_correction;
+	pubCorrect_.publish(msgCorrect_);
+}
 
-	// OVERRIDE USING IMU'S INTERNAL ATTITUDE INFOMATION!
-	// cur_state.q_ = cur_state.q_m_;
+void SSF_Core::toExtState(const State & state, const ros::Time & stamp)
+{
+	msgPoseCtrl_.header.stamp = stamp + ros::Duration(ext_state_latency_);
+	msgPoseCtrl_.header.seq++;
 
-	// first oder quaternion integration
-	cur_state.q_int_.coeffs() = quat_int_int_ * prev_state.q_int_.coeffs(); // quat_int_int_
-	cur_state.q_int_.normalize();
-	
-	// DEBUG
-	// cur_state.q_ = prev_state.q_; 
+	if (ext_state_latency_ <= 0)
+	{
+		eigen_conversions::vector3dToPoint(state.p_, msgPoseCtrl_.pose.position);
+		eigen_conversions::quaternionToMsg(state.q_, msgPoseCtrl_.pose.orientation);
+		eigen_conversions::vector3dToPoint(state.v_, msgPoseCtrl_.velocity);
+		return;
+	}
 
-	// hm: this part shows that C(q_) is a passive transformation from imu to world frame
-	dv = (cur_state.q_.toRotationMatrix() * ea + prev_state.q_.toRotationMatrix() * eaold) / 2.0;
+	// constant angular velocity and acceleration over the latency, as in propagateState()
+	const double dt = ext_state_latency_;
+	const Eigen::Matrix<double, 3, 1> ew = state.w_m_ - state.b_w_;
+	const Eigen::Matrix<double, 3, 1> a = state.q_.toRotationMatrix() * (state.a_m_ - state.b_a_) - g_;
 
-	//dv_int = (cur_state.q_int_.toRotationMatrix() * ea + prev_state.q_int_.toRotationMatrix() * eaold) / 2.0;
-	dv_int = (cur_state.q_int_.toRotationMatrix() * cur_state.a_m_ + prev_state.q_int_.toRotationMatrix() * prev_state.a_m_) / 2.0;
-	
-	
-	dv_without_g = dv - g_;
-	dv_without_g_int = dv_int - g_;
+	Eigen::Quaternion<double> q;
+	q.coeffs() = compute_delta_q(ew, ew, dt) * state.q_.coeffs();
+	q.normalize();
 
-	// for stationary situration, reset acceleration to zero
-	// if (  fabs ( dv_without_g.norm() ) < 0.3 && fabs (dv.norm() - g_.norm()) < 0.1 )
-	// {
-	// 	ROS_WARN_STREAM_THROTTLE(0.25, "Resetting Speed to 90%");
-	// 	// dv_without_g.setZero();
-	// 	prev_state.v_ = prev_state.v_*( 1 - dt*0.1 );
-	// }
-		
+	eigen_conversions::vector3dToPoint(state.p_ + state.v_ * dt + 0.5 * a * dt * dt, msgPoseCtrl_.pose.position);
+	eigen_conversions::quaternionToMsg(q, msgPoseCtrl_.pose.orientation);
+	eigen_conversions::vector3dToPoint(state.v_ + a * dt, msgPoseCtrl_.velocity);
+}
 
-	// ROS_INFO_STREAM_THROTTLE(1, "\ndv-g based on current: " << (cur_state.q_.toRotationMatrix() * ea  - g_).transpose() << std::endl
-	// 	<< "dv-g based on avg (with zero correction): " << dv_without_g.transpose() << std::endl
-	//  	<< "v change:" << (dv_without_g * dt).transpose() );
+bool SSF_Core::isDirty(unsigned char idx)
+{
+	// states from idx_dirty_ up to the newest one are dirty
+	return dirty_ && (unsigned char)(idx_state_ - 1 - idx) <= (unsigned char)(idx_state_ - 1 - idx_dirty_);
+}
 
-	cur_state.v_ = prev_state.v_ + dv_without_g * dt; // dv is world coordinate accerlation
-	cur_state.v_int_ = prev_state.v_int_ + dv_without_g_int * dt;
+void SSF_Core::markDirty(unsigned char idx, int seq)
+{
+	if (idx == idx_state_ || isDirty(idx)) // nothing to replay, or already covered by the dirty range
+		return;
 
-	// // TO PREVENT DRIFT, TRY MAKING THINGS SMALLER
-	// cur_state.v_ = cur_state.v_*(1.0 - dt*1e-1);
+	idx_dirty_ = idx;
+	dirty_seq_ = seq;
+	dirty_ = true;
+}
 
-	cur_state.p_ = prev_state.p_ + ((cur_state.v_ + prev_state.v_) / 2.0 * dt);
-	cur_state.p_int_ = prev_state.p_int_ + ((cur_state.v_int_ + prev_state.v_int_) / 2.0 * dt);
+bool SSF_Core::repropagate(unsigned char idx, double budget)
+{
+	if (!isDirty(idx))
+		return true;
 
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int n = 0;
 
-	///// PUBLISH PURE INTEGRATED STATE FOR DEBUG
+	while (true)
+	{
+		StateBuffer_[idx_dirty_].seq_ = dirty_seq_;
+		propagateState(idx_dirty_, true);
+		idx_dirty_++;
 
-	ros::Time state_time;
-	state_time.fromSec(cur_state.time_);
+		if (idx_dirty_ == idx_state_)
+		{
+			dirty_ = false;
+			return true;
+		}
+		if (idx_dirty_ == (unsigned char)(idx + 1))
+			return true;
 
-	if (state_time > msgIntPose_.header.stamp){ // publish new stuff
-		msgIntPose_.header.stamp = state_time;
-		cur_state.toIntPoseMsg(msgIntPose_);
-		pubIntPose_.publish(msgIntPose_);
+		// replay at least nMinReplay_ states per call, so the dirty range shrinks while new IMU states are appended
+		if (budget > 0 && ++n >= nMinReplay_
+				&& std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() > budget)
+			return false;
 	}
-	
-
-	
-	idx_state_++;  // hm: unsigned char, so will automatically become a ring buffer
 }
 
 	
-void SSF_Core::predictProcessCovariance(const double dt)
-{
-
-	typedef const Eigen::Matrix<double, 3, 3> ConstMatrix3;
-	typedef const Eigen::Matrix<double, 3, 1> ConstVector3;
-	typedef Eigen::Vector3d Vector3;
-
-	// noises
-	ConstVector3 nav = Vector3::Constant(config_.noise_acc /* / sqrt(dt) */);
-	ConstVector3 nbav = Vector3::Constant(config_.noise_accbias /* * sqrt(dt) */);
-
-	ConstVector3 nwv = Vector3::Constant(config_.noise_gyr /* / sqrt(dt) */);
-	ConstVector3 nbwv = Vector3::Constant(config_.noise_gyrbias /* * sqrt(dt) */);
-
-	ConstVector3 nqwvv = Eigen::Vector3d::Constant(config_.noise_qwv);
-	ConstVector3 nqciv = Eigen::Vector3d::Constant(config_.noise_qci);
-	ConstVector3 npicv = Eigen::Vector3d::Constant(config_.noise_pic);
-
-	State & cur_state = StateBuffer_[idx_P_];
-	State & prev_state = StateBuffer_[(unsigned char)(idx_P_ - 1)];
-
-	// bias corrected IMU readings
-	ConstVector3 ew = cur_state.w_m_ - cur_state.b_w_;  // ew: expectation of w, no bias
-	ConstVector3 ewold = prev_state.w_m_ - prev_state.b_w_;
-	ConstVector3 ew_avg = (ew + ewold) / 2.0;
-
-
-	ConstVector3 ea = cur_state.a_m_ - cur_state.b_a_; // hm: why not minus away the gravity?
-	ConstVector3 eaold = prev_state.a_m_ - prev_state.b_a_; // estimated acceleration of previous state
-	ConstVector3 ea_avg = (cur_state.q_.toRotationMatrix() * ea + prev_state.q_.toRotationMatrix() * eaold) / 2.0;
-	// HM: FIXED SMALL Z VARIANCE ISSUE
-	ConstMatrix3 a_sk = skew(ea_avg - g_); //skew(ea); 
-	ConstMatrix3 w_sk = skew(ew_avg); // skew(ew);
-	ConstMatrix3 eye3 = Eigen::Matrix<double, 3, 3>::Identity();
-
-	//ConstMatrix3 C_eq = StateBuffer_[idx_P_].q_.toRotationMatrix();
-	ConstMatrix3 C_eq = (cur_state.q_.toRotationMatrix() + prev_state.q_.toRotationMatrix()) / 2.0;
-
-	const double dt_p2_2 = dt * dt * 0.5; // dt^2 / 2
-	const double dt_p3_6 = dt_p2_2 * dt / 3.0; // dt^3 / 6
-	const double dt_p4_24 = dt_p3_6 * dt * 0.25; // dt^4 / 24
-	const double dt_p5_120 = dt_p4_24 * dt * 0.2; // dt^5 / 120
-
-	ConstMatrix3 Ca3 = C_eq * a_sk;
-	ConstMatrix3 A = Ca3 * (-dt_p2_2 * eye3 + dt_p3_6 * w_sk - dt_p4_24 * w_sk * w_sk);
-	ConstMatrix3 B = Ca3 * (dt_p3_6 * eye3 - dt_p4_24 * w_sk + dt_p5_120 * w_sk * w_sk);
-	ConstMatrix3 D = -A;
-	ConstMatrix3 E = eye3 - dt * w_sk + dt_p2_2 * w_sk * w_sk;
-	ConstMatrix3 F = -dt * eye3 + dt_p2_2 * w_sk - dt_p3_6 * (w_sk * w_sk);
-	ConstMatrix3 C = Ca3 * F;
-
-	// std::cout << "C_eq: " << std::endl << C_eq  << std::endl;
-	// std::cout << "a_sk: " << std::endl <<  a_sk << std::endl;
-	// std::cout << "Ca3: " << std::endl << C_eq * a_sk << std::endl;
-	// std::cout << "A: " << std::endl << A << std::endl;
-	// std::cout << "B: " << std::endl << B << std::endl;
-	// std::cout << "D: " << std::endl << D << std::endl;
-	// std::cout << "E: " << std::endl << E << std::endl;
-	// std::cout << "F: " << std::endl << F << std::endl;
-	// std::cout << "C: " << std::endl << C << std::endl;
-	// std::cout << "dt * eye3: " << std::endl << dt * eye3 << std::endl;
-	// std::cout << "-C_eq * dt_p2_2: " << std::endl << -C_eq * dt_p2_2 << std::endl;
-	// std::cout << "-C_eq * dt: " << std::endl << -C_eq * dt << std::endl;
-
-
-	// discrete error state propagation Matrix Fd according to:
-	// Stephan Weiss and Roland Siegwart.
-	// Real-Time Metric State Estimation for Modular Vision-Inertial Systems.
-	// IEEE International Conference on Robotics and Automation. Shanghai, China, 2011
-	Fd_.setIdentity();
-	Fd_.block<3, 3> (0, 3) = dt * eye3;
-	Fd_.block<3, 3> (0, 6) = A;
-	Fd_.block<3, 3> (0, 9) = B;
-	Fd_.block<3, 3> (0, 12) = -C_eq * dt_p2_2;
-
-	Fd_.block<3, 3> (3, 6) = C;
-	Fd_.block<3, 3> (3, 9) = D;
-	Fd_.block<3, 3> (3, 12) = -C_eq * dt;
-
-	Fd_.block<3, 3> (6, 6) = E;
-	Fd_.block<3, 3> (6, 9) = F;
-
-	calc_Q(dt, StateBuffer_[idx_P_].q_, ew, ea, nav, nbav, nwv, nbwv, config_.noise_scale, nqwvv, nqciv, npicv, Qd_);
-
-	// ROS_INFO_STREAM("Qd_.diagonal():\n" << Qd_.diagonal().transpose());
+void SSF_Core::predictProcessCovariance(const double dt, const ProcessNoise & noise)
+{
+	SSF_ALLOCATION_GUARD_SCOPE("predictProcessCovariance");
+
+	computeProcessModel(idx_P_, dt, noise, Fd_, Qd_);
 
 	StateBuffer_[idx_P_].P_ = Fd_ * StateBuffer_[(unsigned char)(idx_P_ - 1)].P_ * Fd_.transpose() + Qd_;
 
 	idx_P_++;
 }
 
+void SSF_Core::predictProcessCovarianceStride(int n, const ProcessNoise & noise)
+{
+	SSF_ALLOCATION_GUARD_SCOPE("predictProcessCovarianceStride");
+
+	const unsigned char first = idx_P_;
+	const unsigned char last = idx_P_ + n - 1;
+
+	// a single transition over the whole stride, linearized at its end
+	computeProcessModel(last, StateBuffer_[last].time_ - StateBuffer_[(unsigned char)(first - 1)].time_, noise, Fd_, Qd_);
+	StateBuffer_[last].P_ = Fd_ * StateBuffer_[(unsigned char)(first - 1)].P_ * Fd_.transpose() + Qd_;
+
+	// states within the stride get the covariance of its end, which rather over- than underestimates it
+	for (unsigned char i = first; i != last; i++)
+		StateBuffer_[i].P_ = StateBuffer_[last].P_;
+
+	idx_P_ = last + 1;
+}
+
+void SSF_Core::computeProcessModel(const unsigned char idx, const double dt, const ProcessNoise & noise,
+		ErrorStateCov & Fd, ErrorStateCov & Qd)
+{
+	ssf_core::computeProcessModel(StateBuffer_[(unsigned char)(idx - 1)], StateBuffer_[idx], dt, g_, noise, Fd, Qd);
+}
+
+void SSF_Core::propagateCovarianceParallel(int n, const ProcessNoise & noise)
+{
+	const unsigned char first = idx_P_;
+	const int n_chunks = std::min(covariance_pool_->size(), n / nMinCovarianceChunk_);
+
+	auto model = [&](int k, ErrorStateCov & Fd, ErrorStateCov & Qd)
+	{
+		const unsigned char idx = first + k;
+		computeProcessModel(idx, StateBuffer_[idx].time_ - StateBuffer_[(unsigned char)(idx - 1)].time_, noise, Fd, Qd);
+	};
+	auto P = [&](int k) -> ErrorStateCov & {return StateBuffer_[(unsigned char)(first + k)].P_;};
+
+	scanCovariance(StateBuffer_[(unsigned char)(first - 1)].P_, n, n_chunks, model, P,
+			&Fd_buf_[0], &Qd_buf_[0], &chunk_F_[0], &chunk_Q_[0], &chunk_P_[0], *covariance_pool_);
+
+	idx_P_ = first + n;
+}
+
 
 // bool SSF_Core::getStateAtIdx(State* timestate, unsigned char idx)
 // {
@@ -558,7 +1054,7 @@ ClosestStateStatus SSF_Core::getClosestState(State*& timestate, ros::Time tstamp
 
 	idx = (unsigned char)(idx_state_ - 1);
 	double timedist = 1e100;
-	double timenow = tstamp.toSec() - delay - config_.delay; // delay is zero by default
+	double timenow = tstamp.toSec() - delay - params_.get()->config.delay; // delay is zero by default
 
 
 	// vo shouldn't be ahead of imu inputs
@@ -567,6 +1063,11 @@ ClosestStateStatus SSF_Core::getClosestState(State*& timestate, ros::Time tstamp
 		return TOO_EARLY;
 	}
 
+	// zero-delay measurement, closer to the newest state than to its predecessor: no need to search the buffer
+	if (timenow >= (StateBuffer_[idx].time_ + StateBuffer_[(unsigned char)(idx - 1)].time_) / 2.0
+			&& StateBuffer_[(unsigned char)(idx - 1)].time_ != 0)
+		return getHeadState(timestate, idx);
+
 	while (fabs(timenow - StateBuffer_[idx].time_) < timedist) // timedist decreases continuously until best point reached... then rises again
 	{
 		timedist = fabs(timenow - StateBuffer_[idx].time_);
@@ -578,10 +1079,9 @@ ClosestStateStatus SSF_Core::getClosestState(State*& timestate, ros::Time tstamp
 	}
 	idx++; // we subtracted one too much before....
 
-	static bool started = false;
-	if (idx == 1 && !started)
+	if (idx == 1 && !closest_state_started_)
 		idx = 2;
-	started = true;
+	closest_state_started_ = true;
 
 	if (StateBuffer_[idx].time_ == 0)
 	{
@@ -590,49 +1090,120 @@ ClosestStateStatus SSF_Core::getClosestState(State*& timestate, ros::Time tstamp
 		return TOO_OLD; // // early abort // //  not enough predictions made yet to apply measurement (too far in past)
 	}
 
-	propPToIdx(idx); // catch up with covariance propagation if necessary
+	repropagate(idx, 0); // the covariance is caught up by the caller, see prepareMeasurement()
 
 	timestate = &(StateBuffer_[idx]);
 
 	return FOUND;
 }
 
-void SSF_Core::propPToIdx(unsigned char idx)
+ClosestStateStatus SSF_Core::prepareMeasurement(MeasurementSnapshot & snapshot, ros::Time tstamp, double delay)
 {
-	// propagate cov matrix until idx
-	if (idx<idx_state_ && (idx_P_<=idx || idx_P_>idx_state_))	//need to propagate some covs
-		while (idx!=(unsigned char)(idx_P_-1))
-			predictProcessCovariance(StateBuffer_[idx_P_].time_-StateBuffer_[(unsigned char)(idx_P_-1)].time_);
+	std::lock_guard<std::mutex> cov_lock(cov_mutex_);
+
+	State * state_ptr = nullptr;
+	ClosestStateStatus ret;
+	{
+		std::lock_guard<std::mutex> state_lock(state_mutex_);
+		ret = getClosestState(state_ptr, tstamp, delay, snapshot.idx);
+	}
+	if (ret != FOUND)
+		return ret;
+
+	propPToIdx(snapshot.idx); // catch up with covariance propagation if necessary, the IMU path keeps going meanwhile
+
+	std::lock_guard<std::mutex> state_lock(state_mutex_);
+	snapshot.state = *state_ptr;
+	snapshot.version = buffer_version_;
+
+	return FOUND;
 }
 
-// HM: idx_delaystate is the index where it is the closest to the given measurement callback timestamp
-bool SSF_Core::applyCorrection(unsigned char idx_delaystate, const ErrorState & res_delayed, 
-	double fuzzythres, std_msgs::Header msg_header)
+ClosestStateStatus SSF_Core::getHeadState(State*& timestate, unsigned char &idx)
+{
+	idx = (unsigned char)(idx_state_ - 1);
+
+	if (StateBuffer_[idx].time_ == 0)
+	{
+		ROS_WARN( "getHeadState(): no propagated state yet" );
+		return TOO_OLD;
+	}
+
+	repropagate(idx, 0); // no-op unless an earlier delayed correction is still being replayed
+
+	timestate = &(StateBuffer_[idx]);
+
+	return FOUND;
+}
+
+void SSF_Core::propPToIdx(unsigned char idx)
 {
-	if (config_.fixed_scale)
+	unsigned char idx_head;
 	{
-		correction_(15) = 0; //scale
+		// the covariance propagation uses the nominal states, make sure they are up to date
+		std::lock_guard<std::mutex> state_lock(state_mutex_);
+		repropagate(idx, 0);
+		idx_head = idx_state_;
 	}
 
-	if (config_.fixed_bias)
+	// with cov_mutex_ held the states up to idx stay clean, the IMU path only appends after idx_head,
+	// so the nominal states can be read without blocking it
+	// propagate cov matrix until idx
+	if (idx<idx_head && (idx_P_<=idx || idx_P_>idx_head))	//need to propagate some covs
 	{
-		correction_(9) = 0; //acc bias x
-		correction_(10) = 0; //acc bias y
-		correction_(11) = 0; //acc bias z
-		correction_(12) = 0; //gyro bias x
-		correction_(13) = 0; //gyro bias y
-		correction_(14) = 0; //gyro bias z
+		// one parameter snapshot for the whole catch-up, even if a reconfigure comes in meanwhile
+		const Parameters * params = params_.get();
+		const ProcessNoise & noise = params->noise;
+
+		const int n = (unsigned char)(idx - idx_P_) + 1;
+		if (degradation_ >= SKIP_COVARIANCE && n > nCovarianceStride_)
+		{
+			// overload: strides up to idx, the remainder with single steps
+			for (int i = 0; i < n / nCovarianceStride_; i++)
+				predictProcessCovarianceStride(nCovarianceStride_, noise);
+			while (idx!=(unsigned char)(idx_P_-1))
+				predictProcessCovariance(StateBuffer_[idx_P_].time_-StateBuffer_[(unsigned char)(idx_P_-1)].time_, noise);
+		}
+		else if (covariance_pool_ && n >= nMinParallelCovariance_)
+			propagateCovarianceParallel(n, noise);
+		else
+			while (idx!=(unsigned char)(idx_P_-1))
+				predictProcessCovariance(StateBuffer_[idx_P_].time_-StateBuffer_[(unsigned char)(idx_P_-1)].time_, noise);
 	}
+}
+
+bool SSF_Core::gateInnovation(double distance, int dof, const std_msgs::Header & msg_header)
+{
+	const Parameters * params = params_.get();
 
-	if (config_.fixed_calib)
+	const double threshold = params->gateThreshold(dof);
+	const bool accept = !params->config.gate_enable || (distance >= 0 && distance <= threshold); // a NaN distance fails here as well
+
+	if (accept)
+		gate_stats_.accepted++;
+	else
 	{
-		correction_(19) = 0; //q_ic roll
-		correction_(20) = 0; //q_ic pitch
-		correction_(21) = 0; //q_ic yaw
-		correction_(22) = 0; //p_ci x
-		correction_(23) = 0; //p_ci y
-		correction_(24) = 0; //p_ci z
+		gate_stats_.rejected++;
+		if (!realtime_)
+			ROS_WARN_STREAM_THROTTLE(1, "innovation gate rejected measurement: distance " << distance << " > " << threshold
+					<< " (" << dof << " dof), rejected " << gate_stats_.rejected << " of " << gate_stats_.accepted + gate_stats_.rejected);
 	}
+	gate_stats_.last_distance = distance;
+	gate_stats_.last_threshold = threshold;
+
+	output_.gate(msg_header.stamp, msg_header.seq, gate_stats_.accepted, gate_stats_.rejected, distance, threshold);
+
+	return accept;
+}
+
+// HM: idx_delaystate is the index where it is the closest to the given measurement callback timestamp
+bool SSF_Core::applyCorrection(unsigned char idx_delaystate, double delaystate_time, const ErrorState & res_delayed,
+	double fuzzythres, std_msgs::Header msg_header)
+{
+	const Parameters * params = params_.get();
+
+	// fixed scale, biases and calibration states
+	correction_ = correction_.cwiseProduct(params->correction_mask);
 
 	// assert( !( config_.fixed_scale || config_.fixed_bias || config_.fixed_calib ) );
 
@@ -642,6 +1213,16 @@ bool SSF_Core::applyCorrection(unsigned char idx_delaystate, const ErrorState &
 	// store old values in case of fuzzy tracking
 	// TODO: what to do with attitude? augment measurement noise?
 
+	std::lock_guard<std::mutex> state_lock(state_mutex_);
+
+	// the IMU path kept going during the update. If it went a full turn around the ringbuffer, the slot now
+	// holds a state newer than idx_P_, whose covariance gets recomputed anyways: just drop the correction
+	if (StateBuffer_[idx_delaystate].time_ != delaystate_time)
+	{
+		SSF_LOG(WARN, "applyCorrection(): state got overwritten during the update, dropping the correction");
+		return false;
+	}
+
 	State & delaystate = StateBuffer_[idx_delaystate];
 
 	const auto buff_bw = delaystate.b_w_;
@@ -651,34 +1232,12 @@ bool SSF_Core::applyCorrection(unsigned char idx_delaystate, const ErrorState &
 	const auto buff_qci = delaystate.q_ci_;
 	const auto buff_pic = delaystate.p_ci_;
 
-	delaystate.p_ = delaystate.p_ + correction_.block<3, 1> (0, 0);
-	delaystate.v_ = delaystate.v_ + correction_.block<3, 1> (3, 0);
+	// this runs in the guarded update: the messages go through the log ring, which neither allocates nor formats here
 	if (std::abs((correction_(3, 0) + correction_(4, 0) + correction_(5, 0)) / 3.0 )  > 0.8)
-		ROS_WARN_STREAM("Big Velocity Changed Detected: " << (correction_.block<3, 1> (3, 0)).transpose());
-	delaystate.b_w_ = delaystate.b_w_ + correction_.block<3, 1> (9, 0);
-	delaystate.b_a_ = delaystate.b_a_ + correction_.block<3, 1> (12, 0);
-	delaystate.L_ = delaystate.L_ + correction_(15);
-	if (delaystate.L_ < 0)
-	{
-		ROS_WARN_STREAM_THROTTLE(1,"Negative scale detected: " << delaystate.L_ << ". Correcting to 0.1");
-		delaystate.L_ = 0.1;
-	}
+		SSF_LOG(WARN, "Big Velocity Changed Detected: {} {} {}", correction_(3), correction_(4), correction_(5));
 
-	auto qbuff_q = quaternionFromSmallAngle(correction_.block<3, 1> (6, 0));
-
-	// ROS_WARN_STREAM( "qbuff_q: " << qbuff_q.w() << ", " << qbuff_q.vec().transpose() );
-	delaystate.q_ = delaystate.q_ * qbuff_q;
-	delaystate.q_.normalize();
-
-	auto qbuff_qwv = quaternionFromSmallAngle(correction_.block<3, 1> (16, 0));
-	delaystate.q_wv_ = delaystate.q_wv_ * qbuff_qwv;
-	delaystate.q_wv_.normalize();
-
-	auto qbuff_qci = quaternionFromSmallAngle(correction_.block<3, 1> (19, 0));
-	delaystate.q_ci_ = delaystate.q_ci_ * qbuff_qci;
-	delaystate.q_ci_.normalize();
-
-	delaystate.p_ci_ = delaystate.p_ci_ + correction_.block<3, 1> (22, 0);
+	if (!applyErrorState(delaystate, correction_))
+		SSF_LOG(WARN, "Negative scale detected: {}. Correcting to 0.1", buff_L + correction_(15));
 
 	// update qbuff_ and check for fuzzy tracking
 	if (qvw_inittimer_ > nBuff_)
@@ -694,7 +1253,7 @@ bool SSF_Core::applyCorrection(unsigned char idx_delaystate, const ErrorState &
 
 		if (std::max(errq.vec().maxCoeff(), -errq.vec().minCoeff()) / fabs(errq.w()) * 2 > fuzzythres) // fuzzy tracking (small angle approx)
 		{
-			ROS_WARN_STREAM_THROTTLE(1,"fuzzy tracking triggered: " << std::max(errq.vec().maxCoeff(), -errq.vec().minCoeff())/fabs(errq.w())*2 << " limit: " << fuzzythres <<"\n");
+			SSF_LOG(WARN, "fuzzy tracking triggered: {} limit: {}", std::max(errq.vec().maxCoeff(), -errq.vec().minCoeff())/fabs(errq.w())*2, fuzzythres);
 
 			//state_.q_ = buff_q;
 			delaystate.b_w_ = buff_bw;
@@ -704,9 +1263,6 @@ bool SSF_Core::applyCorrection(unsigned char idx_delaystate, const ErrorState &
 			delaystate.q_ci_ = buff_qci;
 			delaystate.p_ci_ = buff_pic;
 			correction_.block<16, 1> (9, 0) = Eigen::Matrix<double, 16, 1>::Zero();
-			qbuff_q.setIdentity();
-			qbuff_qwv.setIdentity();
-			qbuff_qci.setIdentity();
 		}
 		else // if tracking ok: update mean and 3sigma of past N q_vw's
 		{
@@ -720,47 +1276,60 @@ bool SSF_Core::applyCorrection(unsigned char idx_delaystate, const ErrorState &
 		qvw_inittimer_++;
 	}
 
-	// idx fiddeling to ensure correct update until now from the past
-
 	assert(idx_state_ != idx_delaystate);
-	idx_time_ = idx_state_;
-	idx_state_ = idx_delaystate + 1; // reset current state back in time, to be the one after the corrected state
-	idx_P_ = idx_delaystate + 1;
-
 	delaystate.seq_ = msg_header.seq;
-	// propagate state matrix until now
-	while (idx_state_ != idx_time_)
+	buffer_version_++;
+
+	// zero-delay measurement: the newest state got corrected in place, P is already at the head (propPToIdx),
+	// so there is nothing to rewind or replay
+	if (idx_delaystate != (unsigned char)(idx_state_ - 1))
 	{
-		StateBuffer_[idx_state_].seq_ = msg_header.seq;
-		// idx_state_ is current state, idx_state_ - 1 is previous state
-		// idx_state_++ is performed after the routine
-		propagateState(StateBuffer_[idx_state_].time_ - StateBuffer_[(unsigned char)(idx_state_ - 1)].time_);
+		idx_P_ = idx_delaystate + 1;
+
+		if (params->config.lazy_repropagation || degradation_ >= DEFER_REPLAY)
+		{
+			// only remember where the replay has to start, consumers catch up as far as they need
+			markDirty(idx_delaystate + 1, msg_header.seq);
+		}
+		else
+		{
+			// idx fiddeling to ensure correct update until now from the past
+			idx_time_ = idx_state_;
+			idx_state_ = idx_delaystate + 1; // reset current state back in time, to be the one after the corrected state
+
+			// propagate state matrix until now
+			while (idx_state_ != idx_time_)
+			{
+				StateBuffer_[idx_state_].seq_ = msg_header.seq;
+				// idx_state_ is current state, idx_state_ - 1 is previous state
+				propagateState(idx_state_, true);
+				idx_state_++;
+			}
+			dirty_ = false; // everything after idx_delaystate got replayed
+		}
 	}
-		
- 
+
+	// the autopilot needs the correction at its newest state, so a deferred replay has to be done now
+	if (external_propagation_ && !hl_state_buf_.header.stamp.isZero())
+	{
+		repropagate((unsigned char)(idx_state_ - 1), 0);
+		sendCorrection(msg_header);
+	}
+
 	assert(checkForNumeric(&correction_[0], HLI_EKF_STATE_SIZE, "update"));
 
 
 	// ROS_WARN_STREAM("applyCorrection(): now at state time = " << (long long)(StateBuffer_[(unsigned char)(idx_state_ - 1)].time_ * 1e9) << ", state = " << (unsigned int)(idx_state_-1));
 
 	// publish state
-	const unsigned char idx = (unsigned char)(idx_state_ - 1); // Hm: This is the most recent idx, with IMU
+	// Hm: This is the most recent idx, with IMU. In lazy mode the newest clean state is the corrected one
+	const unsigned char idx = dirty_ ? idx_delaystate : (unsigned char)(idx_state_ - 1);
 
-	msgState_.header.stamp = ros::Time().fromSec(StateBuffer_[idx].time_);
-	msgState_.header.seq = StateBuffer_[idx].seq_;
-	msgState_.delay_measurement = (msgState_.header.stamp - msg_header.stamp).toSec() ;
-	StateBuffer_[idx].toStateMsg(msgState_);
-	pubState_.publish(msgState_);
+	const ros::Time state_time = ros::Time().fromSec(StateBuffer_[idx].time_);
+	output_.state(StateBuffer_[idx], state_time, StateBuffer_[idx].seq_, (state_time - msg_header.stamp).toSec());
 
 	// HM: publicise the most accurate estimate, after correction
-	msgPoseCorrected_.header.stamp = msg_header.stamp;
-	msgPoseCorrected_.header.seq = delaystate.seq_;
-
-	if (_is_pose_of_camera_not_imu)
-		delaystate.toPoseMsg_camera(msgPoseCorrected_);
-	else
-		delaystate.toPoseMsg_imu(msgPoseCorrected_);
-	pubPoseCorrected_.publish(msgPoseCorrected_);
+	output_.pose(OutputStage::POSE_CORRECTED, delaystate, msg_header.stamp, delaystate.seq_);
 
 
 	return 1;
@@ -775,63 +1344,54 @@ void SSF_Core::Config(ssf_core::SSF_CoreConfig& config, uint32_t level)
 
 void SSF_Core::DynConfig(ssf_core::SSF_CoreConfig& config, uint32_t level)
 {
-	ROS_INFO_STREAM("DynConfig(): config_ updated!"<< std::endl);
-	config_ = config;
+	// the filter keeps using the previous snapshot for operations already under way
+	const Parameters * params = params_.update(config);
+	ROS_INFO_STREAM("DynConfig(): parameters updated, version " << params->version);
 }
 
 double SSF_Core::getMedian(const Eigen::Matrix<double, nBuff_, 1> & data)
 {
-	std::vector<double> mediandistvec;
-	mediandistvec.reserve(nBuff_);
-	for (int i = 0; i < nBuff_; ++i)
-		mediandistvec.push_back(data(i));
-
-	if (mediandistvec.size() > 0)
-	{
-		std::vector<double>::iterator first = mediandistvec.begin();
-		std::vector<double>::iterator last = mediandistvec.end();
-		std::vector<double>::iterator middle = first + std::floor((last - first) / 2);
-		std::nth_element(first, middle, last); // can specify comparator as optional 4th arg
-		return *middle;
-	}
-	else
-		return 0;
+	// partial sort on a fixed size copy, no heap allocation
+	Eigen::Matrix<double, nBuff_, 1> sorted = data;
+	double * first = sorted.data();
+	double * middle = first + nBuff_ / 2;
+	std::nth_element(first, middle, first + nBuff_);
+	return *middle;
 }
 
 void SSF_Core::broadcast_ci_transformation(const unsigned char idx, const ros::Time& timestamp, bool gotMeasurement)
 {
-	static bool isPreMeasurement = true;
-	static int seq = 0;
-
 	if (gotMeasurement)
 	{
-		isPreMeasurement = false;
-	}else if (!isPreMeasurement)
+		ci_pre_measurement_ = false;
+	}else if (!ci_pre_measurement_)
 		return;
 
 	State &state = StateBuffer_[idx];
 
+	// the calibration hardly changes (not at all with fixed_calib), so it is only re-sent if it moved noticeably
+	if (ci_seq_ > 0 && (state.p_ci_ - last_p_ci_).norm() < tf_calib_position_threshold_
+			&& state.q_ci_.angularDistance(last_q_ci_) < tf_calib_angle_threshold_)
+		return;
+	last_p_ci_ = state.p_ci_;
+	last_q_ci_ = state.q_ci_;
+
 	geometry_msgs::TransformStamped tf_stamped;
-	state.toTransformMsg(tf_stamped,state.p_ci_,state.q_ci_);
+	toTransformMsg(tf_stamped,state.p_ci_,state.q_ci_);
 	// Eigen::Affine3d affine;
 	// affine.translation() = state.p_ci_;
 	// affine.linear() = state.q_ci_.toRotationMatrix();
 
 	// geometry_msgs::TransformStamped tf_stamped = tf2::eigenToTransform(affine);
 	tf_stamped.header.stamp = timestamp;
-	tf_stamped.header.frame_id = "imu_frame";
-	tf_stamped.header.seq = seq;
-	tf_stamped.child_frame_id = "camera_frame";
+	tf_stamped.header.frame_id = tf_prefix_ + "imu_frame";
+	tf_stamped.header.seq = ci_seq_;
+	tf_stamped.child_frame_id = tf_prefix_ + "camera_frame";
 
 
-	try{
-		tf_broadcaster_.sendTransform(tf_stamped);
-	}
-	catch (tf2::TransformException ex){
-		ROS_ERROR("%s",ex.what());
-	}
+	output_.staticTransform(tf_stamped);
 
-	seq++;
+	ci_seq_++;
 
 	//// OLD TF PACKAGE
 	// static tf::TransformBroadcaster tf_broadcaster_;
@@ -857,34 +1417,32 @@ void SSF_Core::broadcast_ci_transformation(const unsigned char idx, const ros::T
 
 void SSF_Core::broadcast_iw_transformation(const unsigned char idx, const ros::Time& timestamp, bool gotMeasurement)
 {
-	static bool isPreMeasurement = true;
-	static int seq = 0;
-
 	if (gotMeasurement)
 	{
-		isPreMeasurement = false;
-	}else if (!isPreMeasurement)
+		iw_pre_measurement_ = false;
+	}else if (!iw_pre_measurement_)
 		return;
+
+	// decimated to ~tf_world_imu_rate, stamps going back in time (e.g. after a reset) restart it
+	if (tf_world_imu_period_ > 0 && iw_seq_ > 0 && timestamp >= last_iw_stamp_
+			&& (timestamp - last_iw_stamp_).toSec() < tf_world_imu_period_)
+		return;
+	last_iw_stamp_ = timestamp;
 	
 	State &state = StateBuffer_[idx];
 
 	geometry_msgs::TransformStamped tf_stamped;
-	//state.toTransformMsg(tf_stamped,state.p_,state.q_);
+	//toTransformMsg(tf_stamped,state.p_,state.q_);
 	// USE IMU INTERNAL MEASURMENT QUAT
-	state.toTransformMsg(tf_stamped,state.p_,state.q_m_);
+	toTransformMsg(tf_stamped,state.p_,state.q_m_);
 
 	tf_stamped.header.stamp = timestamp;
-	tf_stamped.header.frame_id = "world_frame";
-	tf_stamped.header.seq = seq;
-	tf_stamped.child_frame_id = "imu_frame";
+	tf_stamped.header.frame_id = tf_prefix_ + "world_frame";
+	tf_stamped.header.seq = iw_seq_;
+	tf_stamped.child_frame_id = tf_prefix_ + "imu_frame";
 
-	try{
-		tf_broadcaster_.sendTransform(tf_stamped);
-	}
-	catch (tf2::TransformException ex){
-		ROS_ERROR("%s",ex.what());
-	}
-	seq++;
+	output_.transform(tf_stamped);
+	iw_seq_++;
 
 }
 
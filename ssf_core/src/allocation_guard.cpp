@@ -0,0 +1,131 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <ssf_core/allocation_guard.h>
+
+#ifdef SSF_ALLOCATION_GUARD
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+
+extern "C"
+{
+void * __libc_malloc(size_t size);
+void * __libc_calloc(size_t n, size_t size);
+void * __libc_realloc(void * ptr, size_t size);
+void __libc_free(void * ptr);
+}
+
+namespace
+{
+// per thread, so scopes on several threads (IMU spinner, measurement spinners, multi_main workers) do not
+// interfere. initial-exec TLS is resolved at load time: unlike the default model of a shared library its
+// first access never allocates, which would recurse into malloc
+#define SSF_GUARD_TLS __thread __attribute__((tls_model("initial-exec")))
+SSF_GUARD_TLS int depth = 0; ///< guarded scopes the thread is in
+SSF_GUARD_TLS unsigned long allocations = 0; ///< heap operations of the thread inside guarded scopes
+
+std::atomic<bool> armed(false);
+
+inline void countAllocation()
+{
+	if (depth > 0)
+		allocations++;
+}
+}
+
+extern "C"
+{
+void * malloc(size_t size)
+{
+	countAllocation();
+	return __libc_malloc(size);
+}
+
+void * calloc(size_t n, size_t size)
+{
+	countAllocation();
+	return __libc_calloc(n, size);
+}
+
+void * realloc(void * ptr, size_t size)
+{
+	countAllocation();
+	return __libc_realloc(ptr, size);
+}
+
+// freeing takes the allocator locks as well, e.g. when the last reference to a message goes away
+void free(void * ptr)
+{
+	if (ptr)
+		countAllocation();
+	__libc_free(ptr);
+}
+}
+
+namespace ssf_core
+{
+
+AllocationGuard::AllocationGuard(const char * where) :
+	where_(where), allocations_(0), checking_(false)
+{
+	if (!armed.load(std::memory_order_relaxed))
+		return;
+
+	checking_ = true;
+	depth++;
+	allocations_ = allocations;
+}
+
+AllocationGuard::~AllocationGuard()
+{
+	if (!checking_)
+		return;
+
+	const unsigned long n = allocations - allocations_;
+	depth--;
+
+	if (n > 0)
+	{
+		fprintf(stderr, "AllocationGuard: %s allocated or freed heap memory %lu times on the real-time path\n", where_, n);
+		abort();
+	}
+}
+
+void AllocationGuard::arm()
+{
+	armed = true;
+}
+
+}; // end namespace ssf_core
+
+#endif
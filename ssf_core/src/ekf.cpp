@@ -0,0 +1,243 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <ssf_core/ekf.h>
+#include <ssf_core/eigen_utils.h>
+#include "calcQ.h"
+
+#include <iostream>
+
+namespace ssf_core
+{
+
+void ProcessNoise::setConstant(double acc, double accbias, double gyr, double gyrbias, double scale, double qwv,
+		double qci, double pic)
+{
+	n_a.setConstant(acc);
+	n_ba.setConstant(accbias);
+	n_w.setConstant(gyr);
+	n_bw.setConstant(gyrbias);
+	n_L = scale;
+	n_qwv.setConstant(qwv);
+	n_qci.setConstant(qci);
+	n_pic.setConstant(pic);
+}
+
+ErrorState correctionMask(bool fixed_scale, bool fixed_bias, bool fixed_calib)
+{
+	ErrorState mask;
+	mask.setOnes();
+	if (fixed_bias)
+		mask.segment<6>(9).setZero(); // gyro and acc biases
+	if (fixed_scale)
+		mask(15) = 0;
+	if (fixed_calib)
+		mask.segment<6>(19).setZero(); // q_ic, p_ci
+	return mask;
+}
+
+Eigen::Matrix<double, 4, 4> compute_delta_q(const Eigen::Matrix<double, 3, 1> &ew, const Eigen::Matrix<double, 3, 1> &ewold, double dt){
+
+	typedef const Eigen::Matrix<double, 4, 4> ConstMatrix4;
+	// typedef const Eigen::Matrix<double, 3, 1> ConstVector3;
+	typedef Eigen::Matrix<double, 4, 4> Matrix4;
+
+	ConstMatrix4 Omega = omegaMatJPL(ew);
+	ConstMatrix4 OmegaOld = omegaMatJPL(ewold);
+
+	Eigen::Matrix<double, 3, 1>  ew_avg = (ew + ewold) / 2.0;
+
+	//std::cout<< "ew_avg:" << ew_avg.transpose() << std::endl; 
+
+	// if (ew_avg.norm() < 0.01)
+	// 	ew_avg.setZero();
+	// else if (ew_avg.norm() < 0.03)
+	// 	ew_avg = (ew_avg.norm() - 0.01)/0.03 * ew_avg;
+
+
+	Matrix4 OmegaMean = omegaMatJPL(ew_avg);
+
+	// zero order quaternion integration
+	//	cur_state.q_ = (Eigen::Matrix<double,4,4>::Identity() + 0.5*Omega*dt)*StateBuffer_[(unsigned char)(idx_state_-1)].q_.coeffs();
+
+	// first order quaternion integration, this is kind of costly and may not add a lot to the quality of propagation...
+	int div = 1;
+	Matrix4 MatExp;
+	MatExp.setIdentity();
+	OmegaMean *= 0.5 * dt;
+	for (int i = 1; i < 5; i++)
+	{
+		div *= i;
+		MatExp = MatExp + OmegaMean / div;
+		OmegaMean *= OmegaMean;
+	}
+
+	// first oder quat integration matrix
+	ConstMatrix4 quat_int = MatExp + 1.0 / 48.0 * (Omega * OmegaOld - OmegaOld * Omega) * dt * dt;
+
+	return quat_int;
+} 
+
+
+void propagateNominal(const State & prev_state, State & cur_state, const Eigen::Matrix<double, 3, 1> & g)
+{
+	typedef const Eigen::Matrix<double, 3, 1> ConstVector3;
+
+	const double dt = cur_state.time_ - prev_state.time_;
+
+	// zero props:
+	cur_state.b_w_ = prev_state.b_w_;
+	cur_state.b_a_ = prev_state.b_a_;
+	cur_state.L_ = prev_state.L_;
+	cur_state.q_wv_ = prev_state.q_wv_;
+	cur_state.q_ci_ = prev_state.q_ci_;
+	cur_state.p_ci_ = prev_state.p_ci_;
+
+	Eigen::Matrix<double, 3, 1> dv, dv_int, dv_without_g, dv_without_g_int;
+	ConstVector3 ew = cur_state.w_m_ - cur_state.b_w_;
+	ConstVector3 ewold = prev_state.w_m_ - prev_state.b_w_;
+	ConstVector3 ea = cur_state.a_m_ - cur_state.b_a_; // estimated acceleration of current state
+	ConstVector3 eaold = prev_state.a_m_ - prev_state.b_a_; // estimated acceleration of previous state
+
+	auto quat_int = compute_delta_q(ew,ewold,dt);
+
+	auto quat_int_int_ = compute_delta_q(cur_state.w_m_, prev_state.w_m_ , dt);
+
+	// first oder quaternion integration
+	cur_state.q_.coeffs() = quat_int * prev_state.q_.coeffs();
+	cur_state.q_.normalize();
+
+	// first oder quaternion integration
+	cur_state.q_int_.coeffs() = quat_int_int_ * prev_state.q_int_.coeffs(); // quat_int_int_
+	cur_state.q_int_.normalize();
+
+	// hm: this part shows that C(q_) is a passive transformation from imu to world frame
+	dv = (cur_state.q_.toRotationMatrix() * ea + prev_state.q_.toRotationMatrix() * eaold) / 2.0;
+
+	dv_int = (cur_state.q_int_.toRotationMatrix() * cur_state.a_m_ + prev_state.q_int_.toRotationMatrix() * prev_state.a_m_) / 2.0;
+
+	dv_without_g = dv - g;
+	dv_without_g_int = dv_int - g;
+
+	cur_state.v_ = prev_state.v_ + dv_without_g * dt; // dv is world coordinate accerlation
+	cur_state.v_int_ = prev_state.v_int_ + dv_without_g_int * dt;
+
+	cur_state.p_ = prev_state.p_ + ((cur_state.v_ + prev_state.v_) / 2.0 * dt);
+	cur_state.p_int_ = prev_state.p_int_ + ((cur_state.v_int_ + prev_state.v_int_) / 2.0 * dt);
+}
+
+void computeProcessModel(const State & prev_state, const State & cur_state, double dt, const Eigen::Matrix<double, 3, 1> & g,
+		const ProcessNoise & noise, ErrorStateCov & Fd, ErrorStateCov & Qd)
+{
+	typedef const Eigen::Matrix<double, 3, 3> ConstMatrix3;
+	typedef const Eigen::Matrix<double, 3, 1> ConstVector3;
+
+	// bias corrected IMU readings
+	ConstVector3 ew = cur_state.w_m_ - cur_state.b_w_;  // ew: expectation of w, no bias
+	ConstVector3 ewold = prev_state.w_m_ - prev_state.b_w_;
+	ConstVector3 ew_avg = (ew + ewold) / 2.0;
+
+	ConstVector3 ea = cur_state.a_m_ - cur_state.b_a_;
+	ConstVector3 eaold = prev_state.a_m_ - prev_state.b_a_; // estimated acceleration of previous state
+	ConstVector3 ea_avg = (cur_state.q_.toRotationMatrix() * ea + prev_state.q_.toRotationMatrix() * eaold) / 2.0;
+	// HM: FIXED SMALL Z VARIANCE ISSUE
+	ConstMatrix3 a_sk = skew(ea_avg - g);
+	ConstMatrix3 w_sk = skew(ew_avg);
+	ConstMatrix3 eye3 = Eigen::Matrix<double, 3, 3>::Identity();
+
+	ConstMatrix3 C_eq = (cur_state.q_.toRotationMatrix() + prev_state.q_.toRotationMatrix()) / 2.0;
+
+	const double dt_p2_2 = dt * dt * 0.5; // dt^2 / 2
+	const double dt_p3_6 = dt_p2_2 * dt / 3.0; // dt^3 / 6
+	const double dt_p4_24 = dt_p3_6 * dt * 0.25; // dt^4 / 24
+	const double dt_p5_120 = dt_p4_24 * dt * 0.2; // dt^5 / 120
+
+	ConstMatrix3 Ca3 = C_eq * a_sk;
+	ConstMatrix3 A = Ca3 * (-dt_p2_2 * eye3 + dt_p3_6 * w_sk - dt_p4_24 * w_sk * w_sk);
+	ConstMatrix3 B = Ca3 * (dt_p3_6 * eye3 - dt_p4_24 * w_sk + dt_p5_120 * w_sk * w_sk);
+	ConstMatrix3 D = -A;
+	ConstMatrix3 E = eye3 - dt * w_sk + dt_p2_2 * w_sk * w_sk;
+	ConstMatrix3 F = -dt * eye3 + dt_p2_2 * w_sk - dt_p3_6 * (w_sk * w_sk);
+	ConstMatrix3 C = Ca3 * F;
+
+	// discrete error state propagation Matrix Fd according to:
+	// Stephan Weiss and Roland Siegwart.
+	// Real-Time Metric State Estimation for Modular Vision-Inertial Systems.
+	// IEEE International Conference on Robotics and Automation. Shanghai, China, 2011
+	Fd.setIdentity();
+	Fd.block<3, 3> (0, 3) = dt * eye3;
+	Fd.block<3, 3> (0, 6) = A;
+	Fd.block<3, 3> (0, 9) = B;
+	Fd.block<3, 3> (0, 12) = -C_eq * dt_p2_2;
+
+	Fd.block<3, 3> (3, 6) = C;
+	Fd.block<3, 3> (3, 9) = D;
+	Fd.block<3, 3> (3, 12) = -C_eq * dt;
+
+	Fd.block<3, 3> (6, 6) = E;
+	Fd.block<3, 3> (6, 9) = F;
+
+	// calc_Q only writes the non-zero entries
+	Qd.setZero();
+	calc_Q(dt, cur_state.q_, ew, ea, noise.n_a, noise.n_ba, noise.n_w, noise.n_bw, noise.n_L,
+			noise.n_qwv, noise.n_qci, noise.n_pic, Qd);
+}
+
+bool applyErrorState(State & state, const ErrorState & correction)
+{
+	state.p_ = state.p_ + correction.block<3, 1> (0, 0);
+	state.v_ = state.v_ + correction.block<3, 1> (3, 0);
+	state.b_w_ = state.b_w_ + correction.block<3, 1> (9, 0);
+	state.b_a_ = state.b_a_ + correction.block<3, 1> (12, 0);
+
+	bool scale_ok = true;
+	state.L_ = state.L_ + correction(15);
+	if (state.L_ < 0)
+	{
+		state.L_ = 0.1;
+		scale_ok = false;
+	}
+
+	state.q_ = state.q_ * quaternionFromSmallAngle(correction.block<3, 1> (6, 0));
+	state.q_.normalize();
+
+	state.q_wv_ = state.q_wv_ * quaternionFromSmallAngle(correction.block<3, 1> (16, 0));
+	state.q_wv_.normalize();
+
+	state.q_ci_ = state.q_ci_ * quaternionFromSmallAngle(correction.block<3, 1> (19, 0));
+	state.q_ci_.normalize();
+
+	state.p_ci_ = state.p_ci_ + correction.block<3, 1> (22, 0);
+
+	return scale_ok;
+}
+
+}; // end namespace
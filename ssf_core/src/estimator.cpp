@@ -0,0 +1,125 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <ssf_core/estimator.h>
+
+namespace ssf_core
+{
+
+Estimator::Estimator() :
+	buffer_(nBuffer_), idx_head_(0), n_states_(0), idx_closest_(0), closest_time_(0), initialized_(false)
+{
+	g_ << 0, 0, 9.81;
+	noise_.setConstant(0, 0, 0, 0, 0, 0, 0, 0);
+	correction_mask_.setOnes();
+	correction_.setZero();
+}
+
+void Estimator::initialize(const State & state, const Eigen::Matrix<double, 3, 1> & g)
+{
+	g_ = g;
+	buffer_[0] = state;
+	idx_head_ = 1;
+	n_states_ = 1;
+	initialized_ = true;
+}
+
+bool Estimator::addImu(double time, const Eigen::Matrix<double, 3, 1> & a_m, const Eigen::Matrix<double, 3, 1> & w_m)
+{
+	if (!initialized_ || time <= head().time_)
+		return false;
+
+	State & cur_state = buffer_[idx_head_];
+	cur_state.time_ = time;
+	cur_state.a_m_ = a_m;
+	cur_state.w_m_ = w_m;
+	cur_state.seq_ = 0;
+	propagate(idx_head_);
+
+	idx_head_++;
+	if (n_states_ < nBuffer_)
+		n_states_++;
+
+	if (propagated_)
+		propagated_(head());
+
+	return true;
+}
+
+const State * Estimator::closestState(double time)
+{
+	if (!initialized_)
+		return nullptr;
+
+	// newest state not newer than time
+	unsigned char idx = idx_head_ - 1;
+	for (int n = 1; n < n_states_ && buffer_[idx].time_ > time; n++)
+		idx--;
+
+	if (buffer_[idx].time_ > time)
+		return nullptr;
+
+	// or the one after it, if that is closer
+	const unsigned char next = idx + 1;
+	if (next != idx_head_ && buffer_[next].time_ - time < time - buffer_[idx].time_)
+		idx = next;
+
+	idx_closest_ = idx;
+	closest_time_ = buffer_[idx].time_;
+	return &buffer_[idx];
+}
+
+void Estimator::propagate(unsigned char idx)
+{
+	const State & prev_state = buffer_[(unsigned char)(idx - 1)];
+	State & cur_state = buffer_[idx];
+
+	propagateNominal(prev_state, cur_state, g_);
+
+	computeProcessModel(prev_state, cur_state, cur_state.time_ - prev_state.time_, g_, noise_, Fd_, Qd_);
+	cur_state.P_ = Fd_ * prev_state.P_ * Fd_.transpose() + Qd_;
+}
+
+void Estimator::correct(unsigned char idx)
+{
+	correction_ = correction_.cwiseProduct(correction_mask_);
+
+	if (!applyErrorState(buffer_[idx], correction_) && warning_)
+		warning_("negative scale detected, corrected to 0.1");
+
+	if (corrected_)
+		corrected_(buffer_[idx]);
+
+	for (unsigned char i = idx + 1; i != idx_head_; i++)
+		propagate(i);
+}
+
+}; // end namespace
@@ -0,0 +1,187 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#include <ssf_core/logger.h>
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace ssf_core
+{
+
+namespace
+{
+const char * levelName(int level)
+{
+	switch (level)
+	{
+	case SSF_LOG_LEVEL_DEBUG: return "DEBUG";
+	case SSF_LOG_LEVEL_INFO: return "INFO";
+	case SSF_LOG_LEVEL_WARN: return "WARN";
+	default: return "ERROR";
+	}
+}
+}
+
+Logger & Logger::instance()
+{
+	static Logger logger;
+	return logger;
+}
+
+Logger::Logger() :
+	enqueue_pos_(0), dequeue_pos_(0), dropped_(0), dropped_reported_(0), level_(SSF_LOG_LEVEL_DEBUG),
+	binary_sink_(NULL), running_(true)
+{
+	for (size_t i = 0; i < nRing_; i++)
+		ring_[i].sequence.store(i, std::memory_order_relaxed);
+
+	thread_ = std::thread(&Logger::run, this);
+}
+
+Logger::~Logger()
+{
+	running_ = false;
+	thread_.join();
+	flush();
+
+	if (binary_sink_)
+		fclose(binary_sink_);
+}
+
+bool Logger::openBinarySink(const std::string & file)
+{
+	FILE * sink = fopen(file.c_str(), "wb");
+	if (!sink)
+		return false;
+
+	std::lock_guard<std::mutex> lock(consume_mutex_);
+	if (binary_sink_)
+		fclose(binary_sink_);
+	binary_sink_ = sink;
+	return true;
+}
+
+bool Logger::pop(Record & record)
+{
+	Cell & cell = ring_[dequeue_pos_ & (nRing_ - 1)];
+	if (cell.sequence.load(std::memory_order_acquire) != dequeue_pos_ + 1)
+		return false;
+
+	record = cell.record;
+	cell.sequence.store(dequeue_pos_ + nRing_, std::memory_order_release);
+	dequeue_pos_++;
+	return true;
+}
+
+void Logger::flush()
+{
+	std::lock_guard<std::mutex> lock(consume_mutex_);
+
+	Record record;
+	while (pop(record))
+		write(record);
+
+	const uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+	if (dropped != dropped_reported_)
+	{
+		std::cerr << "[WARN] logger: dropped " << dropped - dropped_reported_ << " records, the ring was full" << std::endl;
+		dropped_reported_ = dropped;
+	}
+
+	std::cout.flush();
+	if (binary_sink_)
+		fflush(binary_sink_);
+}
+
+void Logger::run()
+{
+	while (running_)
+	{
+		flush();
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+}
+
+void Logger::write(const Record & record)
+{
+	std::ostringstream text;
+	text << "[" << levelName(record.level) << "] [" << std::fixed << std::setprecision(6) << record.stamp * 1e-9 << "] ";
+	text.unsetf(std::ios::floatfield);
+	text << std::setprecision(15);
+
+	if (record.rows == 0)
+	{
+		// plain values, substitute the placeholders
+		int i = 0;
+		for (const char * c = record.format; *c; c++)
+		{
+			if (c[0] == '{' && c[1] == '}' && i < record.n_values)
+			{
+				text << record.values[i++];
+				c++;
+			}
+			else
+				text << *c;
+		}
+	}
+	else
+	{
+		text << record.format << " [" << record.rows << "x" << record.cols << "]:";
+		const bool vector = record.rows == 1 || record.cols == 1;
+		for (int i = 0; i < record.n_values; i++)
+		{
+			if (!vector && i % record.cols == 0)
+				text << std::endl;
+			text << " " << record.values[i];
+		}
+		if (record.n_values < record.rows * record.cols)
+			text << " ... (truncated)";
+
+		if (binary_sink_)
+		{
+			const int32_t header[] = {record.level, record.rows, record.cols, record.n_values};
+			char name[nBinaryName] = {};
+			strncpy(name, record.format, nBinaryName - 1);
+			fwrite(&record.stamp, sizeof(record.stamp), 1, binary_sink_);
+			fwrite(header, sizeof(header), 1, binary_sink_);
+			fwrite(name, sizeof(name), 1, binary_sink_);
+			fwrite(record.values, sizeof(double), record.n_values, binary_sink_);
+		}
+	}
+
+	(record.level >= SSF_LOG_LEVEL_WARN ? std::cerr : std::cout) << text.str() << std::endl;
+}
+
+}; // end namespace
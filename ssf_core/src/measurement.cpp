@@ -33,7 +33,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 namespace ssf_core{
 
-Measurements::Measurements()
+Measurements::Measurements(const ros::NodeHandle & nh, bool external_scheduling) :
+	nh_(nh), reconfServer_(NULL), ssf_core_(nh, external_scheduling)
 {
 	// setup: initial pos, att, of measurement sensor
 
@@ -45,6 +46,8 @@ Measurements::Measurements()
 
 Measurements::~Measurements()
 {
+	spinners_.clear(); // stops the spinners before their queues go away
+
 	for (Handlers::iterator it(handlers.begin()); it != handlers.end(); ++it)
 		delete *it;
 
@@ -53,6 +56,34 @@ Measurements::~Measurements()
 }
 
 
+void Measurements::startSpinners()
+{
+	int n_threads;
+	nh_.param("measurement_threads", n_threads, 1);
+
+	// the handlers push into a single-producer queue per source, see SSF_Core::addMeasurementSource()
+	if (n_threads > 1 && ssf_core_.usesInputQueues())
+	{
+		ROS_WARN("measurement_threads > 1 needs use_filter_thread:=false, spinning each handler queue with one thread");
+		n_threads = 1;
+	}
+
+	for (Handlers::iterator it(handlers.begin()); it != handlers.end(); ++it)
+	{
+		boost::shared_ptr<ros::AsyncSpinner> spinner(new ros::AsyncSpinner(n_threads, (*it)->getCallbackQueue()));
+		spinner->start();
+		spinners_.push_back(spinner);
+	}
+}
+
+int Measurements::runOnce(int max_items)
+{
+	for (Handlers::iterator it(handlers.begin()); it != handlers.end(); ++it)
+		(*it)->getCallbackQueue()->callAvailable(ros::WallDuration(0));
+
+	return ssf_core_.runOnce(max_items);
+}
+
 void Measurements::Config(ssf_core::SSF_CoreConfig& config, uint32_t level){
   if(level & ssf_core::SSF_Core_INIT_FILTER){  // hm: defined here: INIT_FILTER     = gen.const("INIT_FILTER",
 		init();
@@ -0,0 +1,454 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <ssf_core/output_stage.h>
+#include <tf2_ros/static_transform_broadcaster.h>
+
+#include <map>
+#include <string>
+
+namespace ssf_core
+{
+
+static_assert(sensor_fusion_comm::FilterState::_state_type::static_size == state_layout::value::nValues,
+		"FilterState.msg does not match state_layout.h");
+static_assert(sensor_fusion_comm::FilterState::_covariance_diagonal_type::static_size == N_STATE,
+		"FilterState.msg does not match the error state");
+
+/// sends tf_stamped on tf_static together with the newest transforms of all other child frames of the process
+/**
+ * tf_static is latched per process: every message replaces the previous one of the process, so it has to
+ * carry the transforms of all filters (e.g. several filters in multi_main or one manager's nodelets).
+ */
+static void sendStaticTransform(const geometry_msgs::TransformStamped & tf_stamped)
+{
+	static std::mutex mutex;
+	static std::map<std::string, geometry_msgs::TransformStamped> transforms; ///< by child frame
+	static std::vector<geometry_msgs::TransformStamped> msg;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	static tf2_ros::StaticTransformBroadcaster broadcaster; // created on first use, after ros::init()
+
+	transforms[tf_stamped.child_frame_id] = tf_stamped;
+	msg.clear();
+	for (std::map<std::string, geometry_msgs::TransformStamped>::const_iterator it = transforms.begin(); it != transforms.end(); it++)
+		msg.push_back(it->second);
+	broadcaster.sendTransform(msg);
+}
+
+OutputStage::OutputStage() :
+	pose_of_camera_not_imu_(false), full_covariance_(false), static_transform_pending_(false), running_(false),
+	dropped_(0), pending_(false)
+{
+}
+
+OutputStage::~OutputStage()
+{
+	stop();
+}
+
+void OutputStage::init(ros::NodeHandle & nh, bool pose_of_camera_not_imu, bool async)
+{
+	pose_of_camera_not_imu_ = pose_of_camera_not_imu;
+
+	pubState_ = nh.advertise<sensor_fusion_comm::DoubleArrayStamped> ("state_out", 3);
+	pubFilterState_ = nh.advertise<sensor_fusion_comm::FilterState> ("filter_state", 3);
+	pubPose_[POSE] = nh.advertise<geometry_msgs::PoseWithCovarianceStamped> ("pose", 3);
+	pubPose_[POSE_CORRECTED] = nh.advertise<geometry_msgs::PoseWithCovarianceStamped> ("pose_corrected", 3);
+	pubPose_[POSE_INTEGRATED] = nh.advertise<geometry_msgs::PoseWithCovarianceStamped> ("pose_integrated", 3);
+	pubGate_ = nh.advertise<sensor_fusion_comm::DoubleArrayStamped> ("gate_statistics", 3);
+	pubDegradation_ = nh.advertise<sensor_fusion_comm::DoubleArrayStamped> ("degradation", 3, true);
+
+	const char * names[nThrottledTopics_] = {"pose", "pose_corrected", "pose_integrated", "state_out", "filter_state",
+			"gate_statistics"};
+	for (int topic = 0; topic < nThrottledTopics_; topic++)
+	{
+		double max_rate;
+		nh.param(std::string(names[topic]) + "_max_rate", max_rate, 0.0);
+		throttle_[topic].min_period = max_rate > 0 ? 1.0 / max_rate : 0;
+	}
+
+	msgState_.data.resize(nStateData_, 0);
+	nh.param("filter_state_covariance", full_covariance_, false);
+	if (full_covariance_)
+		msgFilterState_.covariance.resize(state_layout::nPackedCovariance, 0);
+	msgGate_.data.resize(4, 0);
+	msgDegradation_.data.resize(4, 0);
+	msgTransforms_.reserve(nTransformRing_);
+
+	if (async && !thread_.joinable())
+	{
+		running_ = true;
+		thread_ = std::thread(&OutputStage::run, this);
+	}
+}
+
+void OutputStage::stop()
+{
+	if (!thread_.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		running_ = false;
+	}
+	cv_.notify_one();
+	thread_.join();
+}
+
+void OutputStage::pose(PoseTopic topic, const State & state, const ros::Time & stamp, uint32_t seq)
+{
+	if (pubPose_[topic].getNumSubscribers() == 0)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (throttled(topic, stamp))
+			return;
+
+		bool dropped;
+		PoseSnapshot & snapshot = pose_ring_[topic].push(dropped);
+		countDrop(dropped);
+
+		snapshot.stamp = stamp;
+		snapshot.seq = seq;
+		if (topic == POSE_INTEGRATED)
+		{
+			// only the position gets integrated, attitude and covariance stay zero
+			for (int i = 0; i < 3; i++)
+				snapshot.p[i] = state.p_int_[i];
+		}
+		else
+		{
+			const Eigen::Quaternion<double> q = pose_of_camera_not_imu_ ? state.cameraAttitude() : state.q_;
+			for (int i = 0; i < 3; i++)
+				snapshot.p[i] = state.p_[i];
+			snapshot.q[0] = q.w();
+			snapshot.q[1] = q.x();
+			snapshot.q[2] = q.y();
+			snapshot.q[3] = q.z();
+			getPoseCovariance(state, snapshot.cov);
+		}
+		pending_ = true;
+	}
+	flush();
+}
+
+void OutputStage::state(const State & state, const ros::Time & stamp, uint32_t seq, double delay_measurement)
+{
+	const bool state_out = pubState_.getNumSubscribers() > 0;
+	const bool filter_state = pubFilterState_.getNumSubscribers() > 0;
+	if (!state_out && !filter_state)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		bool queued = false;
+		bool dropped;
+
+		if (state_out && !throttled(STATE_OUT, stamp))
+		{
+			StateSnapshot & snapshot = state_ring_.push(dropped);
+			countDrop(dropped);
+
+			snapshot.stamp = stamp;
+			snapshot.seq = seq;
+			snapshot.delay_measurement = delay_measurement;
+			state.toStateArray(snapshot.data);
+			queued = true;
+		}
+
+		if (filter_state && !throttled(FILTER_STATE, stamp))
+		{
+			FilterStateSnapshot & snapshot = filter_state_ring_.push(dropped);
+			countDrop(dropped);
+
+			snapshot.stamp = stamp;
+			snapshot.seq = seq;
+			snapshot.delay_measurement = delay_measurement;
+			state.toStateArray(snapshot.data);
+			if (full_covariance_)
+				state.toPackedCovariance(snapshot.covariance);
+			queued = true;
+		}
+
+		if (!queued)
+			return;
+		pending_ = true;
+	}
+	flush();
+}
+
+void OutputStage::gate(const ros::Time & stamp, uint32_t seq, double accepted, double rejected, double distance,
+		double threshold)
+{
+	if (pubGate_.getNumSubscribers() == 0)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (throttled(GATE_STATISTICS, stamp))
+			return;
+
+		bool dropped;
+		GateSnapshot & snapshot = gate_ring_.push(dropped);
+		countDrop(dropped);
+
+		snapshot.stamp = stamp;
+		snapshot.seq = seq;
+		snapshot.data[0] = accepted;
+		snapshot.data[1] = rejected;
+		snapshot.data[2] = distance;
+		snapshot.data[3] = threshold;
+		pending_ = true;
+	}
+	flush();
+}
+
+void OutputStage::degradation(const ros::Time & stamp, int level, double miss_rate, double deadline,
+		double shed_measurements)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		bool dropped;
+		DegradationSnapshot & snapshot = degradation_ring_.push(dropped);
+		countDrop(dropped);
+
+		snapshot.stamp = stamp;
+		snapshot.data[0] = level;
+		snapshot.data[1] = miss_rate;
+		snapshot.data[2] = deadline;
+		snapshot.data[3] = shed_measurements;
+		pending_ = true;
+	}
+	flush();
+}
+
+void OutputStage::transform(const geometry_msgs::TransformStamped & tf_stamped)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		bool dropped;
+		transform_ring_.push(dropped) = tf_stamped;
+		countDrop(dropped);
+		pending_ = true;
+	}
+	flush();
+}
+
+void OutputStage::staticTransform(const geometry_msgs::TransformStamped & tf_stamped)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		static_transform_ = tf_stamped;
+		static_transform_pending_ = true;
+		pending_ = true;
+	}
+	flush();
+}
+
+void OutputStage::countDrop(bool dropped)
+{
+	if (!dropped)
+		return;
+
+	dropped_++;
+	ROS_WARN_STREAM_THROTTLE(1, "output stage falls behind, dropped " << dropped_ << " snapshots so far");
+}
+
+bool OutputStage::throttled(int topic, const ros::Time & stamp)
+{
+	Throttle & throttle = throttle_[topic];
+
+	// stamps going back in time (e.g. after a reset) restart the limit
+	if (throttle.min_period > 0 && stamp >= throttle.last && (stamp - throttle.last).toSec() < throttle.min_period)
+		return true;
+
+	throttle.last = stamp;
+	return false;
+}
+
+void OutputStage::flush()
+{
+	if (thread_.joinable())
+	{
+		cv_.notify_one();
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(publish_mutex_);
+	publishPending();
+}
+
+void OutputStage::run()
+{
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			cv_.wait(lock, [this]{return pending_ || !running_;});
+			if (!running_)
+				return;
+			pending_ = false;
+		}
+		publishPending();
+	}
+}
+
+void OutputStage::publishPending()
+{
+	PoseSnapshot pose;
+	StateSnapshot state;
+	FilterStateSnapshot filter_state;
+	GateSnapshot gate;
+	DegradationSnapshot degradation;
+
+	bool published = true;
+	while (published)
+	{
+		published = false;
+
+		for (int topic = 0; topic < nPoseTopics_; topic++)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				if (!pose_ring_[topic].pop(pose))
+					continue;
+			}
+			geometry_msgs::PoseWithCovarianceStamped & msg = msgPose_[topic];
+			msg.header.stamp = pose.stamp;
+			msg.header.seq = pose.seq;
+			msg.pose.pose.position.x = pose.p[0];
+			msg.pose.pose.position.y = pose.p[1];
+			msg.pose.pose.position.z = pose.p[2];
+			msg.pose.pose.orientation.w = pose.q[0];
+			msg.pose.pose.orientation.x = pose.q[1];
+			msg.pose.pose.orientation.y = pose.q[2];
+			msg.pose.pose.orientation.z = pose.q[3];
+			msg.pose.covariance = pose.cov;
+			pubPose_[topic].publish(msg);
+			published = true;
+		}
+
+		bool got;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			got = state_ring_.pop(state);
+		}
+		if (got)
+		{
+			msgState_.header.stamp = state.stamp;
+			msgState_.header.seq = state.seq;
+			msgState_.delay_measurement = state.delay_measurement;
+			std::copy(state.data, state.data + nStateData_, msgState_.data.begin());
+			pubState_.publish(msgState_);
+			published = true;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			got = filter_state_ring_.pop(filter_state);
+		}
+		if (got)
+		{
+			msgFilterState_.header.stamp = filter_state.stamp;
+			msgFilterState_.header.seq = filter_state.seq;
+			msgFilterState_.delay_measurement = filter_state.delay_measurement;
+			std::copy(filter_state.data, filter_state.data + state_layout::value::nValues, msgFilterState_.state.begin());
+			std::copy(filter_state.data + state_layout::value::nValues, filter_state.data + nStateData_,
+					msgFilterState_.covariance_diagonal.begin());
+			if (full_covariance_)
+				std::copy(filter_state.covariance, filter_state.covariance + state_layout::nPackedCovariance,
+						msgFilterState_.covariance.begin());
+			pubFilterState_.publish(msgFilterState_);
+			published = true;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			got = gate_ring_.pop(gate);
+		}
+		if (got)
+		{
+			msgGate_.header.stamp = gate.stamp;
+			msgGate_.header.seq = gate.seq;
+			std::copy(gate.data, gate.data + 4, msgGate_.data.begin());
+			pubGate_.publish(msgGate_);
+			published = true;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			got = degradation_ring_.pop(degradation);
+		}
+		if (got)
+		{
+			msgDegradation_.header.stamp = degradation.stamp;
+			std::copy(degradation.data, degradation.data + 4, msgDegradation_.data.begin());
+			pubDegradation_.publish(msgDegradation_);
+			published = true;
+		}
+
+		// one tf message for everything pending
+		msgTransforms_.clear();
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			geometry_msgs::TransformStamped tf_stamped;
+			while (transform_ring_.pop(tf_stamped))
+				msgTransforms_.push_back(tf_stamped);
+		}
+		if (!msgTransforms_.empty())
+		{
+			try{
+				tf_broadcaster_.sendTransform(msgTransforms_);
+			}
+			catch (tf2::TransformException ex){
+				ROS_ERROR("%s",ex.what());
+			}
+			published = true;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			got = static_transform_pending_;
+			if (got)
+				msgStaticTransform_ = static_transform_;
+			static_transform_pending_ = false;
+		}
+		if (got)
+		{
+			sendStaticTransform(msgStaticTransform_);
+			published = true;
+		}
+	}
+}
+
+}; // end namespace ssf_core
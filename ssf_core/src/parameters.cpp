@@ -0,0 +1,84 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#include <ssf_core/parameters.h>
+#include <ssf_core/eigen_utils.h>
+
+namespace ssf_core
+{
+
+Parameters::Parameters(const ssf_core::SSF_CoreConfig & config, unsigned int version) :
+	config(config), version(version)
+{
+	noise.setConstant(config.noise_acc, config.noise_accbias, config.noise_gyr, config.noise_gyrbias, config.noise_scale,
+			config.noise_qwv, config.noise_qci, config.noise_pic);
+
+	correction_mask = correctionMask(config.fixed_scale, config.fixed_bias, config.fixed_calib);
+
+	repropagation_budget = config.lazy_repropagation ? config.repropagation_budget : 0;
+
+	gate_thresholds_[0] = 0;
+	for (int i = 1; i <= nGateCache_; i++)
+		gate_thresholds_[i] = chiSquareQuantile(i, config.gate_probability);
+}
+
+double Parameters::gateThreshold(int dof) const
+{
+	return dof <= nGateCache_ ? gate_thresholds_[dof] : chiSquareQuantile(dof, config.gate_probability);
+}
+
+ParameterStore::ParameterStore() :
+	owned_(new Parameters(ssf_core::SSF_CoreConfig::__getDefault__(), 0))
+{
+	current_.store(owned_.get(), std::memory_order_release);
+}
+
+const Parameters * ParameterStore::update(const ssf_core::SSF_CoreConfig & config)
+{
+	std::lock_guard<std::mutex> lock(update_mutex_);
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+	// snapshots replaced long ago cannot have readers anymore
+	while (!retired_.empty() && now - retired_.front().since > std::chrono::seconds(nGracePeriod_))
+		retired_.pop_front();
+
+	Retired retired;
+	retired.since = now;
+	retired.params = std::move(owned_);
+	owned_.reset(new Parameters(config, retired.params->version + 1));
+	current_.store(owned_.get(), std::memory_order_release);
+	retired_.push_back(std::move(retired));
+
+	return owned_.get();
+}
+
+}; // end namespace
@@ -64,126 +64,26 @@ void State::reset(){
 	seq_ = 0;
 }
 
-void State::getPoseCovariance(geometry_msgs::PoseWithCovariance::_covariance_type & cov)
-{
-	assert(cov.size() == 36);
-
-	for (int i = 0; i < 9; i++)
-		cov[i / 3 * 6 + i % 3] = P_(i / 3 * N_STATE + i % 3);
-
-	for (int i = 0; i < 9; i++)
-		cov[i / 3 * 6 + (i % 3 + 3)] = P_(i / 3 * N_STATE + (i % 3 + 6));
-
-	for (int i = 0; i < 9; i++)
-		cov[(i / 3 + 3) * 6 + i % 3] = P_((i / 3 + 6) * N_STATE + i % 3);
-
-	for (int i = 0; i < 9; i++)
-		cov[(i / 3 + 3) * 6 + (i % 3 + 3)] = P_((i / 3 + 6) * N_STATE + (i % 3 + 6));
-}
-
-void State::toPoseMsg_imu(geometry_msgs::PoseWithCovarianceStamped & pose)
-{
-	eigen_conversions::vector3dToPoint(p_, pose.pose.pose.position);
-	eigen_conversions::quaternionToMsg(q_, pose.pose.pose.orientation);
-	getPoseCovariance(pose.pose.covariance);
-}
-
-void State::toPoseMsg_camera(geometry_msgs::PoseWithCovarianceStamped & pose)
+Eigen::Quaternion<double> State::cameraAttitude() const
 {
 	const static Eigen::Quaternion<double> q_calt_c(-0.5,0.5,0.5,0.5); //w,x,y,z . rotation matrix [0 1 0; 0 0 1 ; 1 0 0]
-	eigen_conversions::vector3dToPoint(p_, pose.pose.pose.position);
-	eigen_conversions::quaternionToMsg(q_*q_ci_*q_calt_c, pose.pose.pose.orientation);
-	getPoseCovariance(pose.pose.covariance);
+	return q_*q_ci_*q_calt_c;
 }
 
-void State::toIntPoseMsg(geometry_msgs::PoseWithCovarianceStamped & pose){
-	eigen_conversions::vector3dToPoint(p_int_,pose.pose.pose.position);
-}
-
-void State::toExtStateMsg(sensor_fusion_comm::ExtState & state)
-{
-	eigen_conversions::vector3dToPoint(p_, state.pose.position);
-	eigen_conversions::quaternionToMsg(q_, state.pose.orientation);
-	eigen_conversions::vector3dToPoint(v_, state.velocity);
-}
-
-void State::toStateMsg(sensor_fusion_comm::DoubleArrayStamped & state)
+void State::toStateArray(double * data) const
 {
-	state.data[0] = p_[0];
-	state.data[1] = p_[1];
-	state.data[2] = p_[2];
-	state.data[3] = v_[0];
-	state.data[4] = v_[1];
-	state.data[5] = v_[2];
-	state.data[6] = q_.w();
-	state.data[7] = q_.x();
-	state.data[8] = q_.y();
-	state.data[9] = q_.z();
-	state.data[10] = b_w_[0];
-	state.data[11] = b_w_[1];
-	state.data[12] = b_w_[2];
-	state.data[13] = b_a_[0];
-	state.data[14] = b_a_[1];
-	state.data[15] = b_a_[2];
-	state.data[16] = L_;
-	state.data[17] = q_wv_.w();
-	state.data[18] = q_wv_.x();
-	state.data[19] = q_wv_.y();
-	state.data[20] = q_wv_.z();
-	state.data[21] = q_ci_.w();
-	state.data[22] = q_ci_.x();
-	state.data[23] = q_ci_.y();
-	state.data[24] = q_ci_.z();
-	state.data[25] = p_ci_[0];
-	state.data[26] = p_ci_[1];
-	state.data[27] = p_ci_[2];
-
-	state.data[28] = P_(0,0); // p
-	state.data[29] = P_(1,1);
-	state.data[30] = P_(2,2);
-
-	state.data[31] = P_(3,3); // v
-	state.data[32] = P_(4,4);
-	state.data[33] = P_(5,5);
-
-	state.data[34] = P_(6,6); // q (theta)
-	state.data[35] = P_(7,7);
-	state.data[36] = P_(8,8);
-
-	state.data[37] = P_(9,9); // b_w
-	state.data[38] = P_(10,10);
-	state.data[39] = P_(11,11);
-
-	state.data[40] = P_(12,12); // b_a
-	state.data[41] = P_(13,13);
-	state.data[42] = P_(14,14);
-
-	state.data[43] = P_(15,15); // L
-
-	state.data[44] = P_(16,16); // q_wv
-	state.data[45] = P_(17,17);
-	state.data[46] = P_(18,18);
-	
-	state.data[47] = P_(19,19); // q_ci
-	state.data[48] = P_(20,20);
-	state.data[49] = P_(21,21);
-
-	state.data[50] = P_(22,22); // p_ci
-	state.data[51] = P_(23,23);
-	state.data[52] = P_(24,24);
-
+#define SSF_STATE_TO_ARRAY(name, member, n, n_error) state_layout::put(data + state_layout::value::name, member);
+	SSF_STATE_LAYOUT(SSF_STATE_TO_ARRAY)
+#undef SSF_STATE_TO_ARRAY
 
+	// followed by the variances
+	for (int i = 0; i < N_STATE; i++)
+		data[state_layout::value::nValues + i] = P_(i, i);
 }
 
-void State::toTransformMsg(geometry_msgs::TransformStamped& tf_stamped, 
-		const Eigen::Matrix<double, 3, 1> translation, const Eigen::Quaternion<double> rotation)
+void State::toPackedCovariance(double * packed) const
 {
-	tf_stamped.transform.translation.x = translation[0];
-	tf_stamped.transform.translation.y = translation[1];
-	tf_stamped.transform.translation.z = translation[2];
-
-	eigen_conversions::quaternionToMsg(rotation, tf_stamped.transform.rotation);
-
+	state_layout::packCovariance(P_, packed);
 }
 
 }; // end namespace ssf_core
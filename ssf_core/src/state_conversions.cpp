@@ -0,0 +1,96 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <ssf_core/state_conversions.h>
+
+namespace ssf_core
+{
+
+void getPoseCovariance(const State & state, geometry_msgs::PoseWithCovariance::_covariance_type & cov)
+{
+	assert(cov.size() == 36);
+	const ErrorStateCov & P = state.P_;
+
+	for (int i = 0; i < 9; i++)
+		cov[i / 3 * 6 + i % 3] = P(i / 3 * N_STATE + i % 3);
+
+	for (int i = 0; i < 9; i++)
+		cov[i / 3 * 6 + (i % 3 + 3)] = P(i / 3 * N_STATE + (i % 3 + 6));
+
+	for (int i = 0; i < 9; i++)
+		cov[(i / 3 + 3) * 6 + i % 3] = P((i / 3 + 6) * N_STATE + i % 3);
+
+	for (int i = 0; i < 9; i++)
+		cov[(i / 3 + 3) * 6 + (i % 3 + 3)] = P((i / 3 + 6) * N_STATE + (i % 3 + 6));
+}
+
+void toPoseMsg_imu(const State & state, geometry_msgs::PoseWithCovarianceStamped & pose)
+{
+	eigen_conversions::vector3dToPoint(state.p_, pose.pose.pose.position);
+	eigen_conversions::quaternionToMsg(state.q_, pose.pose.pose.orientation);
+	getPoseCovariance(state, pose.pose.covariance);
+}
+
+void toPoseMsg_camera(const State & state, geometry_msgs::PoseWithCovarianceStamped & pose)
+{
+	eigen_conversions::vector3dToPoint(state.p_, pose.pose.pose.position);
+	eigen_conversions::quaternionToMsg(state.cameraAttitude(), pose.pose.pose.orientation);
+	getPoseCovariance(state, pose.pose.covariance);
+}
+
+void toIntPoseMsg(const State & state, geometry_msgs::PoseWithCovarianceStamped & pose)
+{
+	eigen_conversions::vector3dToPoint(state.p_int_, pose.pose.pose.position);
+}
+
+void toExtStateMsg(const State & state, sensor_fusion_comm::ExtState & msg)
+{
+	eigen_conversions::vector3dToPoint(state.p_, msg.pose.position);
+	eigen_conversions::quaternionToMsg(state.q_, msg.pose.orientation);
+	eigen_conversions::vector3dToPoint(state.v_, msg.velocity);
+}
+
+void toStateMsg(const State & state, sensor_fusion_comm::DoubleArrayStamped & msg)
+{
+	state.toStateArray(&msg.data[0]);
+}
+
+void toTransformMsg(geometry_msgs::TransformStamped& tf_stamped,
+		const Eigen::Matrix<double, 3, 1> & translation, const Eigen::Quaternion<double> & rotation)
+{
+	tf_stamped.transform.translation.x = translation[0];
+	tf_stamped.transform.translation.y = translation[1];
+	tf_stamped.transform.translation.z = translation[2];
+
+	eigen_conversions::quaternionToMsg(rotation, tf_stamped.transform.rotation);
+}
+
+}; // end namespace ssf_core
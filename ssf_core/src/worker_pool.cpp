@@ -0,0 +1,108 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <ssf_core/worker_pool.h>
+
+namespace ssf_core
+{
+
+WorkerPool::WorkerPool(int n_threads) :
+	running_(true), batch_(0), pending_(0), function_(nullptr), task_(nullptr), n_tasks_(0), next_task_(0)
+{
+	for (int i = 1; i < n_threads; i++)
+		workers_.push_back(std::thread(&WorkerPool::work, this));
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		running_ = false;
+	}
+	start_cv_.notify_all();
+	for (size_t i = 0; i < workers_.size(); i++)
+		workers_[i].join();
+}
+
+void WorkerPool::runBatch(int n_tasks, TaskFunction function, void * task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		function_ = function;
+		task_ = task;
+		n_tasks_ = n_tasks;
+		next_task_ = 0;
+		pending_ = workers_.size();
+		batch_++;
+	}
+	start_cv_.notify_all();
+
+	executeTasks(function, task, n_tasks);
+
+	// the batch must not be replaced while workers still look at it
+	std::unique_lock<std::mutex> lock(mutex_);
+	done_cv_.wait(lock, [this]{return pending_ == 0;});
+}
+
+void WorkerPool::executeTasks(TaskFunction function, void * task, int n_tasks)
+{
+	for (int i = next_task_++; i < n_tasks; i = next_task_++)
+		function(task, i);
+}
+
+void WorkerPool::work()
+{
+	unsigned long seen = 0;
+	while (true)
+	{
+		TaskFunction function;
+		void * task;
+		int n_tasks;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			start_cv_.wait(lock, [&]{return batch_ != seen || !running_;});
+			if (!running_)
+				return;
+			seen = batch_;
+			function = function_;
+			task = task_;
+			n_tasks = n_tasks_;
+		}
+
+		executeTasks(function, task, n_tasks);
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (--pending_ == 0)
+			done_cv_.notify_one();
+	}
+}
+
+}; // end namespace ssf_core
@@ -0,0 +1,168 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+// runs the filter paths of the ROS-free core inside allocation guard scopes: any heap operation after warm-up aborts
+
+#include <ssf_core/estimator.h>
+#include <ssf_core/allocation_guard.h>
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+
+#ifndef SSF_ALLOCATION_GUARD
+#error "build with -DSSF_ALLOCATION_GUARD"
+#endif
+
+using namespace ssf_core;
+
+namespace
+{
+
+const double dt = 0.005;
+
+/// static filter at the origin, warmed up with a few readings
+class AllocationGuardTest : public testing::Test
+{
+protected:
+	virtual void SetUp()
+	{
+		noise_.setConstant(0.05, 0.001, 0.01, 0.0001, 0.001, 0.001, 0.001, 0.001);
+		estimator_.setProcessNoise(noise_);
+		g_ << 0, 0, 9.81;
+
+		State state;
+		state.reset();
+		state.a_m_ = g_;
+		state.P_ = 1e-4 * ErrorStateCov::Identity();
+		estimator_.initialize(state, g_);
+
+		time_ = 0;
+		for (int i = 0; i < 10; i++)
+			addImu();
+
+		SSF_ALLOCATION_GUARD_ARM();
+	}
+
+	void addImu()
+	{
+		time_ += dt;
+		ASSERT_TRUE(estimator_.addImu(time_, g_, Eigen::Matrix<double, 3, 1>(0.01, -0.02, 0.03)));
+	}
+
+	Estimator estimator_;
+	ProcessNoise noise_;
+	Eigen::Matrix<double, 3, 1> g_;
+	double time_;
+};
+
+}
+
+TEST_F(AllocationGuardTest, PropagateState)
+{
+	State prev = estimator_.head();
+	State cur;
+	cur.time_ = prev.time_ + dt;
+	cur.a_m_ = g_;
+	cur.w_m_.setZero();
+
+	SSF_ALLOCATION_GUARD_SCOPE("propagateState");
+	propagateNominal(prev, cur, g_);
+}
+
+TEST_F(AllocationGuardTest, PredictProcessCovariance)
+{
+	State prev = estimator_.head();
+	State cur = prev;
+	cur.time_ += dt;
+	ErrorStateCov Fd, Qd;
+
+	SSF_ALLOCATION_GUARD_SCOPE("predictProcessCovariance");
+	computeProcessModel(prev, cur, dt, g_, noise_, Fd, Qd);
+	cur.P_ = Fd * prev.P_ * Fd.transpose() + Qd;
+}
+
+TEST_F(AllocationGuardTest, ApplyMeasurement)
+{
+	// position measurement, Kalman form
+	const State * state = estimator_.closestState(time_ - 4 * dt);
+	ASSERT_TRUE(state != nullptr);
+
+	Eigen::Matrix<double, 3, N_STATE> H = Eigen::Matrix<double, 3, N_STATE>::Zero();
+	H.leftCols<3>().setIdentity();
+	const Eigen::Matrix<double, 3, 1> r = Eigen::Matrix<double, 3, 1>(0.01, 0.02, 0.03) - state->p_;
+	const Eigen::Matrix<double, 3, 3> R = 1e-4 * Eigen::Matrix<double, 3, 3>::Identity();
+	{
+		SSF_ALLOCATION_GUARD_SCOPE("applyMeasurement");
+		EXPECT_EQ(UPDATE_APPLIED, estimator_.applyMeasurement(H, r, R));
+	}
+
+	// stacked measurement with more rows than the error state, information form
+	const int m = N_STATE + 5;
+	state = estimator_.closestState(time_);
+	ASSERT_TRUE(state != nullptr);
+
+	Eigen::Matrix<double, m, N_STATE> H_stacked = Eigen::Matrix<double, m, N_STATE>::Zero();
+	Eigen::Matrix<double, m, 1> r_stacked;
+	for (int i = 0; i < m; i++)
+	{
+		H_stacked(i, i % 3) = 1;
+		r_stacked(i) = -state->p_(i % 3);
+	}
+	const Eigen::Matrix<double, m, m> R_stacked = 1e-4 * Eigen::Matrix<double, m, m>::Identity();
+	{
+		SSF_ALLOCATION_GUARD_SCOPE("applyMeasurement");
+		EXPECT_EQ(UPDATE_APPLIED, estimator_.applyMeasurement(H_stacked, r_stacked, R_stacked));
+	}
+}
+
+TEST_F(AllocationGuardTest, ImuPath)
+{
+	SSF_ALLOCATION_GUARD_SCOPE("propagateState");
+	for (int i = 0; i < 300; i++) // more than a turn of the ringbuffer
+		addImu();
+}
+
+// the harness only means something if the guard catches a heap operation
+TEST(AllocationGuardDeathTest, AbortsOnAllocation)
+{
+	SSF_ALLOCATION_GUARD_ARM();
+	EXPECT_DEATH({
+		SSF_ALLOCATION_GUARD_SCOPE("test");
+		void * volatile p = malloc(16);
+		(void)p;
+	}, "test allocated or freed heap memory");
+}
+
+int main(int argc, char ** argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,147 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+// checks the parallel covariance catch-up of SSF_Core::propagateCovarianceParallel() against the sequential one
+
+#include <ssf_core/ekf.h>
+#include <ssf_core/worker_pool.h>
+#include <gtest/gtest.h>
+
+#include <Eigen/StdVector>
+#include <cmath>
+#include <vector>
+
+using namespace ssf_core;
+
+namespace
+{
+
+typedef std::vector<State, Eigen::aligned_allocator<State> > StateVector;
+typedef std::vector<ErrorStateCov, Eigen::aligned_allocator<ErrorStateCov> > ErrorStateCovVector;
+
+/// runs the tasks one after the other in reverse order, to catch dependencies between the chunks
+struct SerialPool
+{
+	template<class Task>
+		void run(int n_tasks, Task & task)
+		{
+			for (int i = n_tasks - 1; i >= 0; i--)
+				task(i);
+		}
+};
+
+class CovarianceScanTest : public testing::Test
+{
+protected:
+	virtual void SetUp()
+	{
+		noise_.setConstant(0.05, 0.001, 0.01, 0.0001, 0.001, 0.001, 0.001, 0.001);
+		g_ << 0, 0, 9.81;
+
+		// a wobbling trajectory, so every transition differs
+		states_.resize(nStates_ + 1);
+		states_[0].reset();
+		states_[0].a_m_ = g_;
+		states_[0].P_ = 1e-3 * ErrorStateCov::Identity();
+		for (int k = 1; k <= nStates_; k++)
+		{
+			State & cur = states_[k];
+			cur.time_ = states_[k - 1].time_ + 0.005 * (1 + 0.2 * std::sin(0.7 * k));
+			cur.a_m_ = g_ + Eigen::Matrix<double, 3, 1>(std::sin(0.1 * k), std::cos(0.13 * k), 0.5 * std::sin(0.05 * k));
+			cur.w_m_ << 0.3 * std::cos(0.11 * k), 0.2 * std::sin(0.07 * k), 0.1;
+			propagateNominal(states_[k - 1], cur, g_);
+		}
+
+		// reference: one transition after the other, as predictProcessCovariance()
+		ErrorStateCov Fd, Qd;
+		P_sequential_.resize(nStates_ + 1);
+		P_sequential_[0] = states_[0].P_;
+		for (int k = 1; k <= nStates_; k++)
+		{
+			model(k - 1, Fd, Qd);
+			P_sequential_[k] = Fd * P_sequential_[k - 1] * Fd.transpose() + Qd;
+		}
+	}
+
+	/// transition k of the scan goes from state k to state k + 1
+	void model(int k, ErrorStateCov & Fd, ErrorStateCov & Qd) const
+	{
+		computeProcessModel(states_[k], states_[k + 1], states_[k + 1].time_ - states_[k].time_, g_, noise_, Fd, Qd);
+	}
+
+	template<class Pool>
+		void expectSameAsSequential(int n, int n_chunks, Pool & pool)
+		{
+			ErrorStateCovVector Fd(n), Qd(n), chunk_F(n_chunks), chunk_Q(n_chunks), chunk_P(n_chunks), P_scan(n);
+
+			auto scan_model = [&](int k, ErrorStateCov & F, ErrorStateCov & Q) {model(k, F, Q);};
+			auto P = [&](int k) -> ErrorStateCov & {return P_scan[k];};
+			scanCovariance(states_[0].P_, n, n_chunks, scan_model, P, &Fd[0], &Qd[0], &chunk_F[0], &chunk_Q[0], &chunk_P[0], pool);
+
+			for (int k = 0; k < n; k++)
+			{
+				const ErrorStateCov & expected = P_sequential_[k + 1];
+				ASSERT_LT((P_scan[k] - expected).norm(), 1e-9 * expected.norm())
+						<< "state " << k << " of " << n << " in " << n_chunks << " chunks";
+			}
+		}
+
+	const static int nStates_ = 255; ///< longest catch-up of the ringbuffer
+
+	StateVector states_;
+	ErrorStateCovVector P_sequential_;
+	ProcessNoise noise_;
+	Eigen::Matrix<double, 3, 1> g_;
+};
+
+}
+
+TEST_F(CovarianceScanTest, ChunksMatchSequential)
+{
+	SerialPool pool;
+	// the shortest parallel catch-up of SSF_Core, chunk sizes not dividing n, the full ringbuffer
+	const int cases[][2] = {{32, 4}, {45, 4}, {47, 5}, {100, 3}, {nStates_, 8}, {nStates_, 1}};
+	for (const auto & c : cases)
+		expectSameAsSequential(c[0], c[1], pool);
+}
+
+TEST_F(CovarianceScanTest, WorkerPoolMatchesSequential)
+{
+	WorkerPool pool(4);
+	for (int n = 32; n <= nStates_; n += 37)
+		expectSameAsSequential(n, std::min(pool.size(), n / 8), pool); // as propagateCovarianceParallel()
+}
+
+int main(int argc, char ** argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
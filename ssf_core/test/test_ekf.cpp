@@ -0,0 +1,200 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+// checks the information form update against the Kalman form it replaces for stacked measurements
+
+#include <ssf_core/ekf.h>
+#include <ssf_core/eigen_utils.h>
+#include <gtest/gtest.h>
+
+using namespace ssf_core;
+
+namespace
+{
+
+typedef Eigen::Matrix<double, Eigen::Dynamic, N_STATE> Jacobian;
+
+/// records the innovation distance the update tested
+struct RecordGate
+{
+	double * distance;
+	double threshold;
+
+	bool operator()(double d, int /*dof*/) const
+	{
+		*distance = d;
+		return d <= threshold;
+	}
+};
+
+/// symmetric positive definite covariance, with the states from fixed on zeroed as for fixed_calib
+ErrorStateCov randomCovariance(int fixed = N_STATE)
+{
+	const ErrorStateCov A = ErrorStateCov::Random();
+	ErrorStateCov P = A * A.transpose() / N_STATE + 1e-3 * ErrorStateCov::Identity();
+	P.bottomRows(N_STATE - fixed).setZero();
+	P.rightCols(N_STATE - fixed).setZero();
+	return P;
+}
+
+struct UpdateResult
+{
+	UpdateStatus status;
+	ErrorStateCov P;
+	ErrorState correction;
+	double distance;
+};
+
+UpdateResult kalman(const ErrorStateCov & P, const Jacobian & H, const Eigen::VectorXd & r, const Eigen::MatrixXd & R,
+		double threshold = HUGE_VAL)
+{
+	UpdateResult result;
+	result.P = P;
+	result.correction.setZero();
+	RecordGate gate = {&result.distance, threshold};
+	result.status = kalmanUpdate(result.P, H, r, R, result.correction, gate);
+	return result;
+}
+
+UpdateResult information(const ErrorStateCov & P, const Jacobian & H, const Eigen::VectorXd & r, const Eigen::MatrixXd & R,
+		double threshold = HUGE_VAL)
+{
+	UpdateResult result;
+	result.P = P;
+	result.correction.setZero();
+	RecordGate gate = {&result.distance, threshold};
+	result.status = informationUpdate(result.P, H, r, R, result.correction, gate);
+	return result;
+}
+
+void expectSameUpdate(const UpdateResult & a, const UpdateResult & b)
+{
+	ASSERT_EQ(UPDATE_APPLIED, a.status);
+	ASSERT_EQ(UPDATE_APPLIED, b.status);
+	EXPECT_NEAR(a.distance, b.distance, 1e-8 * a.distance);
+	EXPECT_LT((a.correction - b.correction).norm(), 1e-8 * a.correction.norm());
+	EXPECT_LT((a.P - b.P).norm(), 1e-8 * a.P.norm());
+}
+
+}
+
+TEST(InformationUpdate, MatchesKalmanUpdateForStackedMeasurements)
+{
+	srand(1);
+	const int m = 2 * N_STATE + 3;
+	const ErrorStateCov P = randomCovariance();
+	const Jacobian H = Jacobian::Random(m, N_STATE);
+	const Eigen::VectorXd r = Eigen::VectorXd::Random(m);
+
+	// diagonal R takes the element wise inverse, a full one the factorization
+	const Eigen::MatrixXd R_diag = (Eigen::VectorXd::Random(m).cwiseAbs().array() + 0.1).matrix().asDiagonal();
+	const Eigen::MatrixXd B = Eigen::MatrixXd::Random(m, m);
+	const Eigen::MatrixXd R_full = B * B.transpose() / m + 0.1 * Eigen::MatrixXd::Identity(m, m);
+
+	expectSameUpdate(kalman(P, H, r, R_diag), information(P, H, r, R_diag));
+	expectSameUpdate(kalman(P, H, r, R_full), information(P, H, r, R_full));
+}
+
+TEST(InformationUpdate, HandlesSingularCovariance)
+{
+	srand(2);
+	const int m = N_STATE + 6;
+	const ErrorStateCov P = randomCovariance(N_STATE - 6); // e.g. fixed calibration states
+	const Jacobian H = Jacobian::Random(m, N_STATE);
+	const Eigen::VectorXd r = Eigen::VectorXd::Random(m);
+	const Eigen::MatrixXd R = 0.01 * Eigen::MatrixXd::Identity(m, m);
+
+	const UpdateResult a = kalman(P, H, r, R);
+	const UpdateResult b = information(P, H, r, R);
+	expectSameUpdate(a, b);
+	EXPECT_EQ(0, b.correction.tail(6).norm());
+}
+
+TEST(EkfUpdate, DispatchesOnMeasurementRows)
+{
+	srand(3);
+	const ErrorStateCov P = randomCovariance();
+	for (int m : {3, N_STATE, N_STATE + 1})
+	{
+		const Jacobian H = Jacobian::Random(m, N_STATE);
+		const Eigen::VectorXd r = Eigen::VectorXd::Random(m);
+		const Eigen::MatrixXd R = 0.01 * Eigen::MatrixXd::Identity(m, m);
+
+		ErrorStateCov P_ekf = P;
+		ErrorState correction;
+		ASSERT_EQ(UPDATE_APPLIED, ekfUpdate(P_ekf, H, r, R, correction, AcceptAll()));
+
+		const UpdateResult expected = m > N_STATE ? information(P, H, r, R) : kalman(P, H, r, R);
+		EXPECT_EQ(expected.P, P_ekf) << m << " rows";
+		EXPECT_EQ(expected.correction, correction) << m << " rows";
+	}
+}
+
+TEST(ChiSquareGate, QuantileMatchesTable)
+{
+	// Wilson-Hilferty is within a few 0.1% of the exact quantiles
+	EXPECT_NEAR(7.815, chiSquareQuantile(3, 0.95), 0.01 * 7.815);
+	EXPECT_NEAR(11.345, chiSquareQuantile(3, 0.99), 0.01 * 11.345);
+	EXPECT_NEAR(50.892, chiSquareQuantile(30, 0.99), 0.01 * 50.892);
+	EXPECT_NEAR(124.116, chiSquareQuantile(100, 0.95), 0.01 * 124.116);
+}
+
+TEST(ChiSquareGate, BothFormsGateAlike)
+{
+	srand(4);
+	const int m = N_STATE + 5;
+	const ErrorStateCov P = randomCovariance();
+	const Jacobian H = Jacobian::Random(m, N_STATE);
+	const Eigen::MatrixXd R = 0.01 * Eigen::MatrixXd::Identity(m, m);
+	const double threshold = chiSquareQuantile(m, 0.99);
+
+	// scale the residual to just inside and just outside the gate
+	const Eigen::VectorXd r = Eigen::VectorXd::Random(m);
+	const double distance = kalman(P, H, r, R).distance;
+	const Eigen::VectorXd r_in = r * std::sqrt(0.95 * threshold / distance);
+	const Eigen::VectorXd r_out = r * std::sqrt(1.05 * threshold / distance);
+
+	expectSameUpdate(kalman(P, H, r_in, R, threshold), information(P, H, r_in, R, threshold));
+
+	const UpdateResult a = kalman(P, H, r_out, R, threshold);
+	const UpdateResult b = information(P, H, r_out, R, threshold);
+	EXPECT_EQ(UPDATE_GATED, a.status);
+	EXPECT_EQ(UPDATE_GATED, b.status);
+	EXPECT_NEAR(a.distance, b.distance, 1e-8 * a.distance);
+	EXPECT_EQ(P, b.P); // nothing changed
+	EXPECT_EQ(0, b.correction.norm());
+}
+
+int main(int argc, char ** argv)
+{
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
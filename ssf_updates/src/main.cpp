@@ -90,7 +90,14 @@ int main(int argc, char** argv)
 
 	ROS_INFO_STREAM(""<< topicsStr);
 
-	ros::AsyncSpinner spinner(2);
+	// IMU and measurement handlers have their own queues and spinners, the global queue only serves
+	// dynamic reconfigure and the reset signal
+#ifdef VISIONPOSE_MEAS
+	VisionPoseMeas.startSpinners();
+#endif
+	int spinner_threads;
+	local_nh.param("spinner_threads", spinner_threads, 1);
+	ros::AsyncSpinner spinner(spinner_threads);
 
 	// ROS_INFO("Waiting for reset signal...");
 	// auto msgptr = ros::topic::waitForMessage<std_msgs::Header>("/reset",nh);
@@ -105,20 +112,7 @@ int main(int argc, char** argv)
 	
 	while(ros::ok()){
 		spinner.start();
-		while (ros::ok() && true){
-			// STEP 1, Wait for IMU input to be available, stabilised
-			struct ssf_core::ImuInputsCache imuEstimateMean;
-			VisionPoseMeas.initialiseIMU(imuEstimateMean);
-
-			// STEP 2, Initialise State Zero with State at origin and fake IMU Input
-			if (VisionPoseMeas.initStateZero(imuEstimateMean))
-				break;
-
-			ros::Duration(0.5).sleep();
-		}
-
-		ros::Time global_start = VisionPoseMeas.setGlobalStart();
-		ROS_INFO_STREAM("==============Global Start Time: " << std::fixed <<  global_start <<"==============");
+		VisionPoseMeas.start();
 		// Reset VO integration to identity, therefore enable Measurement Callback
 
 
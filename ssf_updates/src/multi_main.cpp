@@ -0,0 +1,173 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+// hosts many independent visionpose filters in one process, e.g. one per vehicle of a simulation.
+// Every filter lives in its own namespace below the node (~<name>/imu_state_input, ~<name>/pose, ...
+// and its own parameters), all of them are processed by one fixed pool of worker threads.
+
+#include "visionpose_measurements.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+class FilterPool
+{
+public:
+	FilterPool(const std::vector<std::string> & names, ros::NodeHandle & nh) :
+		running_(false), wakeups_(0)
+	{
+		for (size_t i = 0; i < names.size(); i++)
+		{
+			filters_.push_back(std::unique_ptr<VisionPoseMeasurements>(
+					new VisionPoseMeasurements(ros::NodeHandle(nh, names[i]), true)));
+			filters_.back()->ssf_core_.setInputNotification(boost::bind(&FilterPool::notify, this));
+		}
+		claimed_.reset(new std::atomic<bool>[filters_.size()]);
+		for (size_t i = 0; i < filters_.size(); i++)
+			claimed_[i] = false;
+	}
+
+	~FilterPool()
+	{
+		stop();
+	}
+
+	void start(int n_workers, int batch_size)
+	{
+		running_ = true;
+		for (int i = 0; i < n_workers; i++)
+			workers_.push_back(std::thread(&FilterPool::work, this, i, batch_size));
+	}
+
+	void stop()
+	{
+		running_ = false;
+		cv_.notify_all();
+		for (size_t i = 0; i < workers_.size(); i++)
+			workers_[i].join();
+		workers_.clear();
+	}
+
+	VisionPoseMeasurements & filter(size_t i){return *filters_[i];}
+	size_t size(){return filters_.size();}
+
+private:
+	std::vector<std::unique_ptr<VisionPoseMeasurements> > filters_;
+	std::unique_ptr<std::atomic<bool>[]> claimed_; ///< a worker is processing this filter
+	std::vector<std::thread> workers_;
+	std::atomic<bool> running_;
+
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	unsigned long wakeups_; ///< counts new inputs, guarded by mutex_
+
+	void notify()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			wakeups_++;
+		}
+		cv_.notify_one();
+	}
+
+	void work(int id, int batch_size)
+	{
+		const size_t n = filters_.size();
+		size_t first = id % n;
+		unsigned long seen = 0;
+
+		while (running_)
+		{
+			// every filter is processed by at most one worker at a time, this keeps its input queues single producer and consumer
+			int done = 0;
+			for (size_t k = 0; k < n; k++)
+			{
+				const size_t i = (first + k) % n;
+				if (claimed_[i].exchange(true, std::memory_order_acquire))
+					continue;
+				done += filters_[i]->runOnce(batch_size);
+				claimed_[i].store(false, std::memory_order_release);
+			}
+			first = (first + 1) % n;
+
+			if (done > 0)
+				continue;
+
+			// ROS callback queues do not notify, so wake up at least every millisecond to serve them
+			std::unique_lock<std::mutex> lock(mutex_);
+			cv_.wait_for(lock, std::chrono::milliseconds(1), [&]{return wakeups_ != seen || !running_;});
+			seen = wakeups_;
+		}
+	}
+};
+
+int main(int argc, char** argv)
+{
+	ros::init(argc, argv, "ekf_fusion");
+	ros::NodeHandle local_nh("~");
+
+	std::vector<std::string> names;
+	local_nh.getParam("filters", names);
+	if (names.empty())
+	{
+		ROS_ERROR("no filters given, set ~filters to the list of filter namespaces");
+		return 1;
+	}
+
+	int worker_threads, batch_size, spinner_threads;
+	local_nh.param("worker_threads", worker_threads, (int)std::max(1u, std::thread::hardware_concurrency()));
+	local_nh.param("batch_size", batch_size, 32);
+	local_nh.param("spinner_threads", spinner_threads, 1);
+
+	FilterPool pool(names, local_nh);
+	ROS_INFO("Filter type: visionpose_sensor, %zu instances on %d worker threads", pool.size(), worker_threads);
+
+	// the global queue only serves dynamic reconfigure, inputs are spun by the workers
+	ros::AsyncSpinner spinner(spinner_threads);
+	spinner.start();
+	pool.start(worker_threads, batch_size);
+
+	// start-up blocks until the IMU settled, so every filter starts on its own
+	std::vector<std::thread> starters;
+	for (size_t i = 0; i < pool.size(); i++)
+		starters.push_back(std::thread([&pool, i]{pool.filter(i).start();}));
+
+	ros::waitForShutdown();
+
+	for (size_t i = 0; i < starters.size(); i++)
+		starters[i].join();
+	pool.stop();
+
+	return 0;
+}
@@ -40,12 +40,17 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <vector>
 
 #include <chrono>
+#include <functional>
 #include <thread>
 
 class VisionPoseMeasurements : public ssf_core::Measurements
 {
 public:
-	VisionPoseMeasurements() // hm: the first constructor to call, since "main.cpp"
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	/// \param nh private node handle of this filter instance, see ssf_core::SSF_Core
+	VisionPoseMeasurements(const ros::NodeHandle & nh = ros::NodeHandle("~"), bool external_scheduling = false) :
+		ssf_core::Measurements(nh, external_scheduling) // hm: the first constructor to call, since "main.cpp"
 	{
 		addHandler(new VisionPoseSensorHandler(this));
 		// hm: addHandler is defined in "measurement.h" in ssf_core
@@ -61,7 +66,7 @@ public:
 		// VisionPoseSensorHandler(*) is responsible for handling measurementCallback
 		// - it also inherit and public SSF_Core() instance: ssf_core_. this is how SSF_core is engaged
 
-		ros::NodeHandle pnh("~");
+		ros::NodeHandle pnh(nh_);
 		pnh.param("init/p_ci/x", p_ci_[0], 0.0);
 		pnh.param("init/p_ci/y", p_ci_[1], 0.0);
 		pnh.param("init/p_ci/z", p_ci_[2], 0.0);
@@ -126,7 +131,7 @@ public:
 			//// IMPORTANT: gravity direction is straight upwards!
 			
 
-			std::cout << "g_ = " << std::endl << g_.transpose() << std::endl;
+			SSF_LOG_MATRIX(INFO, "g_", g_.transpose());
 
 			normalvec_down = - imuEstimateMean.a_m_.normalized().array(); // negative direction of gravity acceleration
 
@@ -149,9 +154,9 @@ public:
 
 			
 			// rotation matrix R_wi represents the world frame (NED) coordinate in IMU-Frame
-			std::cout << "normalvec_north: " << normalvec_north.transpose() << std::endl;
-			std::cout << "normalvec_east: " << normalvec_east.transpose() << std::endl;
-			std::cout << "normalvec_down: " << normalvec_down.transpose() << std::endl;
+			SSF_LOG_MATRIX(INFO, "normalvec_north", normalvec_north.transpose());
+			SSF_LOG_MATRIX(INFO, "normalvec_east", normalvec_east.transpose());
+			SSF_LOG_MATRIX(INFO, "normalvec_down", normalvec_down.transpose());
 
 			Eigen::Matrix3d R_si, R_is;
 			R_si << normalvec_north, normalvec_east, normalvec_down;
@@ -162,7 +167,7 @@ public:
 			R_iw = R_sw * R_is;
 
 			
-			std::cout << "R_iw = " << std::endl << R_iw << std::endl;
+			SSF_LOG_MATRIX(INFO, "R_iw", R_iw);
 
 			Eigen::Quaternion<double> q_iw(R_iw);
 			q_iw_ = q_iw;
@@ -205,7 +210,10 @@ public:
 	// 	ssf_core_.broadcast_ci_transformation(0, timestamp);
 	// }
 
-	void initialiseIMU(struct ssf_core::ImuInputsCache& imuEstimateMean)
+	/// waits until the IMU readings settled, returns false if ok() turned false before
+	/** see start() for ok and spin */
+	bool initialiseIMU(struct ssf_core::ImuInputsCache& imuEstimateMean, const std::function<bool()> & ok = &ros::ok,
+			bool spin = true)
 	{	
 		ROS_INFO("Waiting for IMU inputs...");
 
@@ -216,7 +224,7 @@ public:
 			struct ssf_core::ImuInputsCache avg;
 			struct ssf_core::ImuInputsCache var;
 		};
-		while (ros::ok())
+		while (ok())
 		{
 			std::vector<AverageVariance> result_vec;
 			if (ssf_core_.getImuInputsCache(imuCache,imuCache_size) )
@@ -241,7 +249,7 @@ public:
 					result_vec.push_back(result);
 				}
 
-				std::cout << "=============IMU Variance Statitics==============" << std::endl;
+				SSF_LOG(INFO, "=============IMU Variance Statitics==============");
 
 				struct AverageVariance max_result = {};
 
@@ -274,18 +282,14 @@ public:
 				max_result.var.q_m_.coeffs() /= result_vec.size();
 
 
-				std::cout << "avg.a_m_" << max_result.avg.a_m_.transpose();
-				std::cout << "\tvar.a_m_" << max_result.var.a_m_.transpose();
-				std::cout << std::endl;
-				std::cout << "avg.w_m_" << max_result.avg.w_m_.transpose();
-				std::cout << "\tvar.w_m_" << max_result.var.w_m_.transpose();
-				std::cout << std::endl;
-				std::cout << "avg.m_m_" << max_result.avg.m_m_.transpose();
-				std::cout << "\tvar.m_m_" << max_result.var.m_m_.transpose();
-				std::cout << std::endl;
-				std::cout << "avg.q_m_" << max_result.avg.q_m_.coeffs().transpose();
-				std::cout << "\tvar.q_m_" << max_result.var.q_m_.coeffs().transpose();
-				std::cout << std::endl;
+				SSF_LOG_MATRIX(INFO, "avg.a_m_", max_result.avg.a_m_.transpose());
+				SSF_LOG_MATRIX(INFO, "var.a_m_", max_result.var.a_m_.transpose());
+				SSF_LOG_MATRIX(INFO, "avg.w_m_", max_result.avg.w_m_.transpose());
+				SSF_LOG_MATRIX(INFO, "var.w_m_", max_result.var.w_m_.transpose());
+				SSF_LOG_MATRIX(INFO, "avg.m_m_", max_result.avg.m_m_.transpose());
+				SSF_LOG_MATRIX(INFO, "var.m_m_", max_result.var.m_m_.transpose());
+				SSF_LOG_MATRIX(INFO, "avg.q_m_", max_result.avg.q_m_.coeffs().transpose());
+				SSF_LOG_MATRIX(INFO, "var.q_m_", max_result.var.q_m_.coeffs().transpose());
 
 				// can be 0.8, 0.05, 0.002
 				if (max_result.var.a_m_.norm() < 0.1 && max_result.var.w_m_.norm() < 0.002 && max_result.var.m_m_.norm() < 0.05 ) // variance smaller than 0.05 m/s^2
@@ -308,11 +312,42 @@ public:
 					
 			}
 			ros::Duration(0.25).sleep();
-			ros::spinOnce();
+			if (spin)
+				ros::spinOnce();
 		}
+		if (!ok())
+			return false;
 
-		std::cout << "=============IMU Variance PASS==============" << std::endl;
-		
+		SSF_LOG(INFO, "=============IMU Variance PASS==============");
+		return true;
+	}
+
+	/// runs the start-up sequence: waits for the IMU to settle, initialises state zero and sets the global start
+	/**
+	 * blocks until the filter is running or ok() turns false, returns the global start time or zero if stopped.
+	 * spin serves the global callback queue while waiting, which only the owner of that queue may do, i.e.
+	 * not a nodelet.
+	 */
+	ros::Time start(const std::function<bool()> & ok = &ros::ok, bool spin = true)
+	{
+		while (ok()){
+			// STEP 1, Wait for IMU input to be available, stabilised
+			struct ssf_core::ImuInputsCache imuEstimateMean;
+			if (!initialiseIMU(imuEstimateMean, ok, spin))
+				return ros::Time();
+
+			// STEP 2, Initialise State Zero with State at origin and fake IMU Input
+			if (initStateZero(imuEstimateMean))
+				break;
+
+			ros::Duration(0.5).sleep();
+		}
+		if (!ok())
+			return ros::Time();
+
+		ros::Time global_start = setGlobalStart();
+		ROS_INFO_STREAM("==============Global Start Time: " << std::fixed <<  global_start <<"==============");
+		return global_start;
 	}
 
 	ros::Time setGlobalStart()
@@ -352,10 +387,10 @@ private:
 
 	bool init()
 	{
-		std::cout << "calculated q_iw_ = " << q_iw_.coeffs().transpose() << std::endl; // x,y,z,w
+		SSF_LOG_MATRIX(INFO, "calculated q_iw_", q_iw_.coeffs().transpose()); // x,y,z,w
 
 		auto q_iw_m_ = Eigen::Quaternion<double>(R_sw)*q_m_;
-		std::cout << "compared to measured R_sw * q_m_" << q_iw_m_.coeffs().transpose() << std::endl;
+		SSF_LOG_MATRIX(INFO, "compared to measured R_sw * q_m_", q_iw_m_.coeffs().transpose());
 
 
 		double dev = 180.0/M_PI*std::acos( 2 * std::pow(q_iw_m_.coeffs().dot(q_iw_.coeffs()),2.0) - 1.0 );
@@ -372,8 +407,8 @@ private:
 			return false;
 		}
 
-		std::cout << "b_a_ = " << std::endl << b_a_.transpose() << std::endl;
-		std::cout << "b_w_ = " << std::endl << b_w_.transpose() << std::endl;
+		SSF_LOG_MATRIX(INFO, "b_a_", b_a_.transpose());
+		SSF_LOG_MATRIX(INFO, "b_w_", b_w_.transpose());
 
 		if (a_m_.isZero() )
 		{
@@ -415,7 +450,7 @@ private:
 
 		P_ = P_diagonal.asDiagonal();
 
-		std::cout << "P diagonal = " << P_diagonal.transpose() << std::endl;
+		SSF_LOG_MATRIX(INFO, "P diagonal", P_diagonal.transpose());
 
 
 		ssf_core_.initialize(p_iw_, v_iw_, q_iw_, b_w_, b_a_, scale_, q_wv_, P_, w_m_, a_m_, m_m_, g_, q_ci_, p_ci_);
@@ -0,0 +1,122 @@
+/*
+
+Copyright (c) 2010, Stephan Weiss, ASL, ETH Zurich, Switzerland
+You can contact the author at <stephan dot weiss at ieee dot org>
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of ETHZ-ASL nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL ETHZ-ASL BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+// loads the visionpose filter into a nodelet manager. IMU and pose messages published by other nodelets
+// of the same manager (e.g. the IMU driver and the visual odometry) then arrive as shared pointers,
+// without serialization.
+
+#include "visionpose_measurements.h"
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include <ros/topic.h>
+#include <std_msgs/Header.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+namespace ssf_updates
+{
+
+class VisionPoseNodelet : public nodelet::Nodelet
+{
+public:
+	VisionPoseNodelet() : running_(false) {}
+
+	~VisionPoseNodelet()
+	{
+		running_ = false;
+		if (start_thread_.joinable())
+			start_thread_.join();
+	}
+
+private:
+	virtual void onInit()
+	{
+		ros::NodeHandle & pnh = getPrivateNodeHandle();
+		pnh.param("publish_reset", publish_reset_, true);
+
+		// same topics and parameters below the nodelet name as below the node name of visionpose_sensor
+		measurements_.reset(new VisionPoseMeasurements(pnh));
+		NODELET_INFO_STREAM("Filter type: visionpose_sensor");
+
+		// the handlers spin on their own queues, the manager serves dynamic reconfigure
+		measurements_->startSpinners();
+
+		// the start-up sequence waits for the IMU to settle, onInit() must not block the manager
+		running_ = true;
+		start_thread_ = std::thread(&VisionPoseNodelet::run, this);
+	}
+
+	/// start-up and in-process resets, as in main.cpp
+	void run()
+	{
+		ros::NodeHandle nh(getNodeHandle());
+
+		if (publish_reset_)
+		{
+			ros::Publisher reset_pub = nh.advertise<std_msgs::Header>("/reset", 3);
+			ros::Duration(2).sleep(); // wait for setup of network connection with other nodes
+
+			std_msgs::Header header;
+			header.stamp = ros::Time::now();
+			reset_pub.publish(header);
+		}
+
+		// the manager spins the global queue, so only poll while waiting for the IMU, and stop on unload
+		auto ok = [this]{return running_ && ros::ok();};
+		while (ok())
+		{
+			measurements_->start(ok, false);
+
+			// poll, so unloading the nodelet does not hang on the reset topic
+			while (running_ && ros::ok())
+			{
+				if (ros::topic::waitForMessage<std_msgs::Header>("/reset", nh, ros::Duration(1.0)))
+				{
+					NODELET_INFO("In-process RESET detected, restarting...");
+					break;
+				}
+			}
+		}
+	}
+
+	std::unique_ptr<VisionPoseMeasurements> measurements_;
+	bool publish_reset_;
+	std::atomic<bool> running_;
+	std::thread start_thread_;
+};
+
+}; // end namespace
+
+PLUGINLIB_EXPORT_CLASS(ssf_updates::VisionPoseNodelet, nodelet::Nodelet)
@@ -42,16 +42,15 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 //#define DEBUG_ON
 
-#define N_MEAS 6 /// one artificial constraints, six measurements
-
 int noise_iterator = 1;
 
 VisionPoseSensorHandler::VisionPoseSensorHandler(ssf_core::Measurements* meas) :    // parent class pointer points child class
 	MeasurementHandler(meas), lastMeasurementTime_(ros::Time(0))
 {
 	// read some parameters
-	ros::NodeHandle pnh("~");
-	ros::NodeHandle nh;
+	ros::NodeHandle pnh(measurements->getNodeHandle());
+	ros::NodeHandle nh(measurements->getNodeHandle());
+	nh.setCallbackQueue(&callback_queue_);
 	pnh.param("measurement_world_sensor", measurement_world_sensor_, true);
 	pnh.param("use_fixed_covariance", use_fixed_covariance_, true);
 
@@ -70,7 +69,11 @@ VisionPoseSensorHandler::VisionPoseSensorHandler(ssf_core::Measurements* meas) :
 void VisionPoseSensorHandler::subscribe()
 {
 	// has_measurement = false;
-	ros::NodeHandle nh("~");
+	ros::NodeHandle nh(measurements->getNodeHandle());
+	nh.setCallbackQueue(&callback_queue_);
+	int priority;
+	nh.param("measurement_priority", priority, 0); // decimated first under overload if lower than other sources
+	measurement_source_ = measurements->ssf_core_.addMeasurementSource(priority);
 	subMeasurement_ = nh.subscribe("visionpose_measurement", 10, &VisionPoseSensorHandler::measurementCallback, this);
 
 	measurements->ssf_core_.registerCallback(&VisionPoseSensorHandler::noiseConfig, this);
@@ -121,6 +124,14 @@ void VisionPoseSensorHandler::magTimerCallback(const ros::TimerEvent& te){
 
 // void VisionPoseSensorHandler::measurementCallback(const geometry_msgs::PoseStampedConstPtr & msg)
  void VisionPoseSensorHandler::measurementCallback(const geometry_msgs::PoseWithCovarianceStampedConstPtr poseMsg)
+{
+	// the filter thread (if any) processes the measurement in time order with the IMU readings
+	measurements->ssf_core_.postMeasurement(measurement_source_, poseMsg->header.stamp,
+			&ssf_core::SSF_Core::measurementCallback<VisionPoseSensorHandler, geometry_msgs::PoseWithCovarianceStamped,
+					&VisionPoseSensorHandler::processMeasurement>, this, poseMsg);
+}
+
+void VisionPoseSensorHandler::processMeasurement(const geometry_msgs::PoseWithCovarianceStampedConstPtr poseMsg)
 {
 
 	// if (poseMsg->header.stamp.isZero())
@@ -205,66 +216,70 @@ void VisionPoseSensorHandler::magTimerCallback(const ros::TimerEvent& te){
 
 	R(3,3) = R(4,4) = R(5,5) = n_zq_;
 
-	//////////////////////////////////////////////////////////////////
-	//////// Start mutex
-	/////////////////////////////////////////////////////////////////
-
-	measurements->ssf_core_.mutexLock();
-
-	// ROS_INFO_STREAM("Measurement Callback for frame at " << time_old);
-
-	// find closest predicted state in time which fits the measurement time
-	ssf_core::State* state_old_ptr = nullptr;
-	unsigned char idx;
+	// find closest predicted state in time which fits the measurement time and take a snapshot of it. H, residual
+	// and noise are built on the snapshot without holding the core mutex, which is only taken for the update itself.
+	// If another correction got applied in between, the snapshot is outdated and the measurement is processed again.
+	ssf_core::MeasurementSnapshot snapshot;
+	ssf_core::CommitStatus status = ssf_core::STALE;
 
-	// A LOOP TO TRY UNTIL VO IS NOT TOO EARLY
+	for (int attempt = 0; attempt < 3 && status == ssf_core::STALE; attempt++)
 	{
+		// A LOOP TO TRY UNTIL VO IS NOT TOO EARLY
 		ssf_core::ClosestStateStatus ret = ssf_core::TOO_EARLY;
 
 		while(ret == ssf_core::TOO_EARLY && ros::ok()){
-			ret = measurements->ssf_core_.getClosestState(state_old_ptr, time_old,0.0, idx);
+			ret = measurements->ssf_core_.prepareMeasurement(snapshot, time_old, 0.0);
 
 			if (ret == ssf_core::TOO_EARLY){
-				measurements->ssf_core_.mutexUnlock();
+				// never block the filter thread, it is the one propagating the states
+				if (measurements->ssf_core_.usesInputQueues())
+					break;
 				ROS_INFO("Wait 200ms as VO is too fast");
 				ros::Duration(0.2).sleep();
-				measurements->ssf_core_.mutexLock();
 			}
-				
 		}
 
 		if (ret != ssf_core::FOUND){
-		ROS_WARN("finding Closest State not possible, reject measurement");
-		measurements->ssf_core_.mutexUnlock();
-		return;
-	}
+			ROS_WARN("finding Closest State not possible, reject measurement");
+			return;
+		}
+
+		SSF_LOG(DEBUG, "{}th measurement frame found state buffer at time {} at index {}", _seq, snapshot.state.time_, snapshot.idx);
 
+		Eigen::Matrix<double, N_MEAS, N_MEAS> R_old = R;
+		if (!computeUpdate(snapshot.state, isVelocity, H_old, r_old, R_old))
+		{
+			ROS_WARN("Apply Measurement SKIPED");
+			break;
+		}
+
+		// call update step in core class
+		boost::function<void(ssf_core::State&)> pre_update;
+		if (!isVelocity)
+			pre_update = &VisionPoseSensorHandler::resetVelocity; // setting zero
 
+		status = measurements->ssf_core_.commitMeasurement(snapshot, H_old, r_old, R_old, poseMsg->header, 0.1, pre_update);
+
+		if (status == ssf_core::REJECTED)
+			ROS_WARN("Apply Measurement failed (rejected by innovation gate?)");
 	}
-	
-	
 
-	
-	// int num_state = measurements->ssf_core_.getNumberofState();
+	if (status == ssf_core::STALE)
+		ROS_WARN("Measurement dropped, state buffer kept changing while it was processed");
 
-	
-	
-	// if (state_old_ptr == nullptr)
-	// {
-	// 	ROS_WARN_STREAM("measurement callback early abort: no past state with the timestamp found: " 
-	// 			<< std::fixed << time_old.toSec() << std::endl);
-	// 	ROS_WARN_STREAM("number of states: " << num_state);
-	// 	exit(-1); // CRITICAL ERROR
-	// 	return; // // early abort // //
-	// }
+	// broadcast the calibration as well as posterior pose estimate, to external VO.
+	measurements->ssf_core_.mutexLock();
+	measurements->ssf_core_.broadcast_ci_transformation(snapshot.idx,time_old,true);
+	measurements->ssf_core_.broadcast_iw_transformation(snapshot.idx,time_old,true);
+	measurements->ssf_core_.mutexUnlock();
 
-	ssf_core::State state_old = *state_old_ptr;
-	// auto diff = state_old.time_ - time_old.toSec();
-	ros::Time buffer_time;
-	buffer_time.fromSec(state_old.time_);
-	std::cout << std::endl << std::endl <<
-		_seq << "th measurement frame found state buffer at time " << buffer_time << " at index " << (int)idx << std::endl;
+	//ROS_DEBUG_STREAM("Processed Measurement and broacased ci & iw transforms " << poseMsg->header.seq);
+}
 
+bool VisionPoseSensorHandler::computeUpdate(const ssf_core::State & state_old, bool isVelocity,
+		Eigen::Matrix<double, N_MEAS, N_STATE> & H_old, Eigen::Matrix<double, N_MEAS, 1> & r_old,
+		Eigen::Matrix<double, N_MEAS, N_MEAS> & R)
+{
 	z_q_ = state_old.q_m_; // use IMU's internal q estimate as the FAKE measurement
 	Eigen::Matrix3d R_sw;
 	R_sw << 0 , 1 , 0,
@@ -343,10 +358,6 @@ void VisionPoseSensorHandler::magTimerCallback(const ros::TimerEvent& te){
 
 	if (!isVelocity)
 	{
-		//////////////////////////////////
-		// setting zero
-		state_old_ptr->v_ << 0,0,0;
-		/////////////////////////
 		H_old.block<3, 3> (0, 0) = _identity3 * state_old.L_; // p
 		// H_old.block<3, 3> (0, 6) = - C_q.transpose() * pci_sk * state_old.L_; // q
 		H_old.block<3, 1> (0, 15) =  state_old.p_; // C_q.transpose() * state_old.p_ci_ + state_old.p_; // L
@@ -418,7 +429,7 @@ void VisionPoseSensorHandler::magTimerCallback(const ros::TimerEvent& te){
 
 	
 	// ROS_INFO_STREAM( "H_old" << std::endl << H_old );
-	std::cout << "r_old = " << std::endl << r_old.transpose() << std::endl;
+	SSF_LOG_MATRIX(DEBUG, "r_old", r_old.transpose());
 
 	//ROS_INFO_STREAM( "P_old" << std::endl << state_old.P_ );
 	
@@ -432,12 +443,11 @@ void VisionPoseSensorHandler::magTimerCallback(const ros::TimerEvent& te){
 		do_update = false;
 	}
 
-	// check v difference
+	// check v difference, statistical outliers are rejected by the innovation gate in the core
 	if (r_old.block<3, 1>(0, 0).norm() > 10.0)
 	{
 		ROS_WARN_STREAM("Big Velocity Difference Detected: " << (r_old.block<3, 1>(0, 0).norm()) );
 		do_update = false;
-		exit(1);
 	}
 
 	
@@ -450,48 +460,12 @@ void VisionPoseSensorHandler::magTimerCallback(const ros::TimerEvent& te){
 	// 	exit(1);
 	// }
 
-	if ( (state_old.v_ - state_old_ptr->v_).norm() > 3 )
+	// position measurements reset the velocity before the update, see measurementCallback()
+	if (!isVelocity && state_old.v_.norm() > 3 )
 	{
 		ROS_WARN("BAD Velocity (v_), skipping update");
 		do_update = false;
 	}
 
-
-	if (do_update)
-	{
-		bool result = measurements->ssf_core_.applyMeasurement(idx, H_old, r_old, R, poseMsg->header);
-		if (!result)
-			ROS_WARN("Apply Measurement failed (imu not initialised properly?)");
-
-		// double check corrected angle
-
-		// double theta_dev_after = 180.0/M_PI*std::acos( 2 * std::pow(z_q_.coeffs().dot(state_old_ptr->q_.coeffs()),2.0) - 1.0 );
-		// ROS_WARN_STREAM( "after correction theta_dev (deg): " << theta_dev_after);
-		// ROS_WARN_STREAM( "theta after: " << state_old_ptr->q_.w() << ", " << state_old_ptr->q_.vec().transpose());
-
-		// if (fabs(theta_dev_after) > 4  && theta_dev_after / theta_dev > 5)
-		// {
-		// 	ROS_WARN("BAD Variance of theta (q)");
-		// 	exit(1);
-		// }
-		
-	}
-	else{
-		ROS_WARN("Apply Measurement SKIPED");
-	}
-
-	
-	
-
-	// broadcast the calibration as well as posterior pose estimate, to external VO.
-	measurements->ssf_core_.broadcast_ci_transformation(idx,time_old,true);
-	measurements->ssf_core_.broadcast_iw_transformation(idx,time_old,true);
-
-	//ROS_DEBUG_STREAM("Processed Measurement and broacased ci & iw transforms " << poseMsg->header.seq);
-
-	///////////////////////////////////////////////////////////////
-	//////// mutext unlock
-	///////////////////////////////////////////////////////////////
-
-	measurements->ssf_core_.mutexUnlock();
+	return do_update;
 }
@@ -35,6 +35,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <ssf_core/measurement.h>
 #include <geometry_msgs/PoseWithCovarianceStamped.h>
 
+#define N_MEAS 6 /// one artificial constraints, six measurements
+
 class VisionPoseSensorHandler : public ssf_core::MeasurementHandler
 {
 private:
@@ -46,6 +48,7 @@ private:
   double n_zq_;                     /// noise for attitude measurement
 
   ros::Subscriber subMeasurement_;
+  int measurement_source_; ///< queue of this handler in the filter thread
 
   ros::Timer timer_mag_measure;
 
@@ -57,9 +60,16 @@ private:
 
   void subscribe();
   void measurementCallback(const geometry_msgs::PoseWithCovarianceStampedConstPtr poseMsg);
+  void processMeasurement(const geometry_msgs::PoseWithCovarianceStampedConstPtr poseMsg);
   void magTimerCallback(const ros::TimerEvent& te);
   void noiseConfig(ssf_core::SSF_CoreConfig& config, uint32_t level);
 
+  /// builds H, residual and measurement noise on a snapshot of the buffered state, returns false to skip the update
+  bool computeUpdate(const ssf_core::State & state_old, bool isVelocity, Eigen::Matrix<double, N_MEAS, N_STATE> & H_old,
+      Eigen::Matrix<double, N_MEAS, 1> & r_old, Eigen::Matrix<double, N_MEAS, N_MEAS> & R);
+
+  static void resetVelocity(ssf_core::State & state){state.v_.setZero();}
+
   void initMeasurement(){
       lastMeasurementTime_ =  ros::Time(0);
   }